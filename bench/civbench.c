@@ -0,0 +1,550 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "ast.h"
+#include "ast_binary.h"
+#include "ast_frozen.h"
+#include "ast_helpers.h"
+#include "ast_visitor.h"
+#include "generator.h"
+#include "parser.h"
+#include "phases.h"
+#include "source.h"
+#include "symbol.h"
+
+const char *usage_msg =
+"Usage: %s [OPTIONS]\n"
+"\n"
+"Run the component benchmarks on a generated CiviC program and print one\n"
+"JSON object per benchmark to stdout.\n"
+"\n"
+"Options:\n"
+"  -g N  Number of global variables (default 1000).\n"
+"  -f N  Number of functions (default 200).\n"
+"  -n N  Nesting depth of local functions (default 2).\n"
+"  -e N  Depth of generated expressions (default 4).\n"
+"  -l N  Number of loops per function (default 8).\n"
+"  -s N  Seed of the generator (default 42).\n"
+"  -r N  Repetitions per benchmark; the fastest run is reported (default 5).\n"
+"  -o F  Write the generated program to file F and exit.\n"
+;
+
+
+COMPILER_PHASES
+
+typedef struct {
+    FILE *input;
+    source_file *source;
+    size_t bytes;
+    unsigned int repeat;
+    const generator_params *params;
+} bench;
+
+static double bench_clock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const bench *b, const char *name, const char *unit,
+        size_t items, double seconds)
+{
+    const generator_params *p = b->params;
+
+    printf("{\"bench\": \"%s\", \"globals\": %u, \"functions\": %u, "
+           "\"nesting\": %u, \"expr_depth\": %u, \"loops\": %u, "
+           "\"bytes\": %zu, \"%s\": %zu, \"seconds\": %.6f, "
+           "\"%s_per_second\": %.0f}\n", name, p->globals, p->functions,
+           p->nesting, p->expr_depth, p->loops, b->bytes, unit, items,
+           seconds, unit, seconds > 0 ? items / seconds : 0);
+}
+
+// Every benchmark runs in a fresh compilation unit: a new arena and symbol
+// table, like a single invocation of civcc.
+static void unit_begin(arena **mem, symbol_table **symbols, int use_arena)
+{
+    *mem = use_arena ? arena_new() : NULL;
+    *symbols = symbol_table_new();
+
+    ast_use_arena(*mem);
+    ast_use_symbols(*symbols);
+}
+
+static void unit_end(arena *mem, symbol_table *symbols, ast_node *root)
+{
+    if (mem)
+        arena_free(mem);
+    else
+        ast_free_node(root);
+
+    symbol_table_free(symbols);
+    ast_use_arena(NULL);
+    ast_use_symbols(NULL);
+}
+
+static ast_node *bench_parse(const bench *b)
+{
+    parse_context *ctx = parse_context_new_source(b->source);
+    ast_node *root = ctx ? parse_context_run(ctx) : NULL;
+
+    if (!root) {
+        fprintf(stderr, "civbench: generated program does not parse\n");
+        exit(1);
+    }
+
+    parse_context_free(ctx);
+
+    return root;
+}
+
+// Scan the mapped program in place, as civcc does for files, or stream it
+// through stdio, as civcc does for stdin.
+static void bench_lexer(const bench *b, int mapped)
+{
+    unsigned int r;
+    double best = 0;
+    size_t tokens = 0;
+    arena *mem;
+    symbol_table *symbols;
+
+    for (r = 0; r < b->repeat; r++) {
+        unit_begin(&mem, &symbols, 1);
+
+        rewind(b->input);
+
+        parse_context *ctx = mapped ? parse_context_new_source(b->source) :
+            parse_context_new_stream(b->input);
+
+        double start = bench_clock();
+
+        tokens = parse_context_lex(ctx);
+
+        double t = bench_clock() - start;
+
+        parse_context_free(ctx);
+        unit_end(mem, symbols, NULL);
+
+        if (!r || t < best)
+            best = t;
+    }
+
+    bench_report(b, mapped ? "lex" : "lex-stream", "tokens", tokens, best);
+}
+
+static void bench_parser(const bench *b)
+{
+    unsigned int r;
+    double best = 0;
+    size_t nodes = 0;
+    arena *mem;
+    symbol_table *symbols;
+
+    for (r = 0; r < b->repeat; r++) {
+        unit_begin(&mem, &symbols, 1);
+
+        double start = bench_clock();
+        ast_node *root = bench_parse(b);
+        double t = bench_clock() - start;
+
+        nodes = ast_node_count(root);
+        unit_end(mem, symbols, root);
+
+        if (!r || t < best)
+            best = t;
+    }
+
+    bench_report(b, "parse", "nodes", nodes, best);
+}
+
+// Memory used by the parsed tree: the arena holds only nodes and their
+// children arrays, so this is the footprint of the tree per node.
+static void bench_memory(const bench *b)
+{
+    arena *mem;
+    symbol_table *symbols;
+
+    unit_begin(&mem, &symbols, 1);
+
+    ast_node *root = bench_parse(b);
+    size_t nodes = ast_node_count(root);
+
+    printf("{\"bench\": \"memory\", \"nodes\": %zu, \"node_size\": %zu, "
+           "\"bytes\": %zu, \"bytes_per_node\": %.1f}\n", nodes,
+           sizeof(ast_node), mem->allocated, (double)mem->allocated / nodes);
+
+    unit_end(mem, symbols, root);
+}
+
+static void bench_clone_free(const bench *b, int use_arena)
+{
+    unsigned int r;
+    double best_clone = 0, best_free = 0;
+    size_t nodes = 0;
+    arena *mem;
+    symbol_table *symbols;
+
+    for (r = 0; r < b->repeat; r++) {
+        unit_begin(&mem, &symbols, use_arena);
+
+        ast_node *root = bench_parse(b);
+        nodes = ast_node_count(root);
+
+        double start = bench_clock();
+        ast_node *copy = ast_node_clone(root);
+        double t_clone = bench_clock() - start;
+
+        start = bench_clock();
+
+        if (use_arena)
+            arena_free(mem);
+        else
+            ast_free_node(copy);
+
+        double t_free = bench_clock() - start;
+
+        unit_end(use_arena ? NULL : mem, symbols, use_arena ? NULL : root);
+
+        if (!r || t_clone < best_clone)
+            best_clone = t_clone;
+
+        if (!r || t_free < best_free)
+            best_free = t_free;
+    }
+
+    bench_report(b, use_arena ? "clone_arena" : "clone_malloc", "nodes",
+            nodes, best_clone);
+    bench_report(b, use_arena ? "free_arena" : "free_malloc", "nodes",
+            nodes, best_free);
+}
+
+static ast_visit_result count_node(ast_walker *walker, ast_node *node)
+{
+    (void) node;
+
+    (*(size_t *) walker->data)++;
+
+    return AST_VISIT_CONTINUE;
+}
+
+// Traversal throughput of the tree as the analysis phase sees it: visiting
+// the nodes the context analysis acts upon, through the pointer tree and
+// through the frozen tree, and the cost of freezing it.
+static void bench_traversal(const bench *b)
+{
+    static const ast_visitor visitor = {
+        .pre = {
+            [NODE_FN_BODY] = &count_node,
+            [NODE_CALL] = &count_node,
+            [NODE_ASSIGN] = &count_node,
+        },
+    };
+
+    double best_walk = 0, best_freeze = 0, best_scan = 0;
+    size_t nodes = 0, i, found_walk = 0, found_scan = 0;
+    unsigned int r;
+    arena *mem;
+    symbol_table *symbols;
+
+    for (r = 0; r < b->repeat; r++) {
+        unit_begin(&mem, &symbols, 1);
+
+        ast_node *root = bench_parse(b);
+
+        for (i = 0; i < sizeof(preprocess_passes) / sizeof(pass_info); i++)
+            preprocess_passes[i].run(root);
+
+        nodes = ast_node_count(root);
+        found_walk = found_scan = 0;
+
+        double start = bench_clock();
+        ast_walk(root, &visitor, &found_walk);
+        double t_walk = bench_clock() - start;
+
+        start = bench_clock();
+        ast_frozen *tree = ast_freeze(root);
+        double t_freeze = bench_clock() - start;
+
+        start = bench_clock();
+
+        for (i = 0; i < tree->count; i++) {
+            switch (AST_FROZEN_NODE_TYPE(tree, i)) {
+            case NODE_FN_BODY:
+            case NODE_CALL:
+            case NODE_ASSIGN:
+                found_scan++;
+                break;
+            default:
+                break;
+            }
+        }
+
+        double t_scan = bench_clock() - start;
+
+        ast_frozen_free(tree);
+        unit_end(mem, symbols, root);
+
+        if (found_walk != found_scan) {
+            fprintf(stderr, "civbench: frozen scan found %zu nodes, the walk "
+                    "%zu\n", found_scan, found_walk);
+            exit(1);
+        }
+
+        if (!r || t_walk < best_walk)
+            best_walk = t_walk;
+
+        if (!r || t_freeze < best_freeze)
+            best_freeze = t_freeze;
+
+        if (!r || t_scan < best_scan)
+            best_scan = t_scan;
+    }
+
+    bench_report(b, "walk_tree", "nodes", nodes, best_walk);
+    bench_report(b, "freeze", "nodes", nodes, best_freeze);
+    bench_report(b, "walk_frozen", "nodes", nodes, best_scan);
+}
+
+// Whether a loaded tree has the shape, data and declarations of the tree it
+// was written from. The identifiers are compared by name, since the trees live
+// in units with their own symbol tables.
+static int binary_equal(const ast_node *a, const ast_node *b)
+{
+    unsigned int i;
+
+    if (a->type != b->type || a->nary != b->nary || a->offset != b->offset
+            || !a->decl != !b->decl)
+        return 0;
+
+    if (a->decl && (a->decl->type != b->decl->type
+                || a->decl->offset != b->decl->offset))
+        return 0;
+
+    if (ast_has_symbol(a)) {
+        if (!a->data.sval != !b->data.sval || (a->data.sval
+                    && strcmp(a->data.sval, b->data.sval)))
+            return 0;
+    } else if (memcmp(&a->data, &b->data, sizeof(ast_data_type)))
+        return 0;
+
+    for (i = 0; i < a->nary; i++)
+        if (b->children[i]->parent != b
+                || !binary_equal(a->children[i], b->children[i]))
+            return 0;
+
+    return 1;
+}
+
+// Writing the analysed tree in binary form and loading it again, in a unit of
+// its own, which is what a compilation from a .ast file does instead of
+// scanning, parsing, preprocessing and analysing.
+static void bench_binary(const bench *b)
+{
+    double best_write = 0, best_load = 0;
+    size_t nodes = 0, i;
+    unsigned int r;
+    arena *mem, *load_mem;
+    symbol_table *symbols, *load_symbols;
+
+    for (r = 0; r < b->repeat; r++) {
+        unit_begin(&mem, &symbols, 1);
+
+        ast_node *root = bench_parse(b);
+
+        for (i = 0; i < sizeof(preprocess_passes) / sizeof(pass_info); i++)
+            preprocess_passes[i].run(root);
+
+        for (i = 0; i < sizeof(analyse_passes) / sizeof(pass_info); i++)
+            analyse_passes[i].run(root);
+
+        nodes = ast_node_count(root);
+
+        FILE *file = tmpfile();
+
+        if (!file) {
+            perror("tmpfile");
+            exit(1);
+        }
+
+        double start = bench_clock();
+        int written = ast_binary_write(root, file) && !fflush(file);
+        double t_write = bench_clock() - start;
+
+        if (!written) {
+            perror("ast_binary_write");
+            exit(1);
+        }
+
+        unit_begin(&load_mem, &load_symbols, 1);
+
+        start = bench_clock();
+        ast_binary *image = ast_binary_load_fd(fileno(file));
+        double t_load = bench_clock() - start;
+
+        if (!image) {
+            perror("ast_binary_load");
+            exit(1);
+        }
+
+        if (!binary_equal(root, image->root)) {
+            fprintf(stderr, "civbench: loaded tree differs from the tree it "
+                    "was written from\n");
+            exit(1);
+        }
+
+        ast_binary_free(image);
+        fclose(file);
+        unit_end(load_mem, load_symbols, NULL);
+        unit_end(mem, symbols, root);
+
+        if (!r || t_write < best_write)
+            best_write = t_write;
+
+        if (!r || t_load < best_load)
+            best_load = t_load;
+    }
+
+    bench_report(b, "write_ast", "nodes", nodes, best_write);
+    bench_report(b, "load_ast", "nodes", nodes, best_load);
+}
+
+// Time every pass on its own, on a tree that went through all passes before
+// it.
+static void bench_passes(const bench *b)
+{
+    struct {
+        const char *name;
+        pass_info *passes;
+        size_t count;
+    } phases[] = {
+        {"preprocess", preprocess_passes,
+            sizeof(preprocess_passes) / sizeof(pass_info)},
+        {"analyse", analyse_passes, sizeof(analyse_passes) / sizeof(pass_info)},
+        {"loops", loops_passes, sizeof(loops_passes) / sizeof(pass_info)},
+        {"optimize", optimize_passes,
+            sizeof(optimize_passes) / sizeof(pass_info)},
+    };
+
+    size_t nphases = sizeof(phases) / sizeof(phases[0]);
+    size_t p, i, q, j;
+    unsigned int r;
+    char name[64];
+    arena *mem;
+    symbol_table *symbols;
+
+    for (p = 0; p < nphases; p++) {
+        for (i = 0; i < phases[p].count; i++) {
+            double best = 0;
+            size_t nodes = 0;
+
+            for (r = 0; r < b->repeat; r++) {
+                unit_begin(&mem, &symbols, 1);
+
+                ast_node *root = bench_parse(b);
+
+                for (q = 0; q <= p; q++)
+                    for (j = 0; j < (q < p ? phases[q].count : i); j++)
+                        phases[q].passes[j].run(root);
+
+                nodes = ast_node_count(root);
+
+                double start = bench_clock();
+                phases[p].passes[i].run(root);
+                double t = bench_clock() - start;
+
+                unit_end(mem, symbols, root);
+
+                if (!r || t < best)
+                    best = t;
+            }
+
+            snprintf(name, sizeof(name), "pass_%s", phases[p].passes[i].name);
+            bench_report(b, name, "nodes", nodes, best);
+        }
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    generator_params params = GENERATOR_DEFAULTS;
+    const char *output = NULL;
+    unsigned int repeat = 5;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || strlen(argv[i]) != 2 || i + 1 >= argc) {
+            printf(usage_msg, argv[0]);
+            return 1;
+        }
+
+        const char *value = argv[++i];
+
+        switch (argv[i - 1][1]) {
+            case 'g': params.globals = atoi(value); break;
+            case 'f': params.functions = atoi(value); break;
+            case 'n': params.nesting = atoi(value); break;
+            case 'e': params.expr_depth = atoi(value); break;
+            case 'l': params.loops = atoi(value); break;
+            case 's': params.seed = atoi(value); break;
+            case 'r': repeat = atoi(value); break;
+            case 'o': output = value; break;
+            default:
+                printf(usage_msg, argv[0]);
+                return 1;
+        }
+    }
+
+    if (output) {
+        FILE *out = fopen(output, "w");
+
+        if (!out) {
+            perror("fopen");
+            return 1;
+        }
+
+        generate_program(out, &params);
+        fclose(out);
+
+        return 0;
+    }
+
+    bench b = {
+        .input = tmpfile(),
+        .repeat = repeat ? repeat : 1,
+        .params = &params,
+    };
+
+    if (!b.input) {
+        perror("tmpfile");
+        return 1;
+    }
+
+    b.bytes = generate_program(b.input, &params);
+    fflush(b.input);
+
+    if (!(b.source = source_map_fd(fileno(b.input)))) {
+        perror("mmap");
+        return 1;
+    }
+
+    bench_lexer(&b, 1);
+    bench_lexer(&b, 0);
+    bench_parser(&b);
+    bench_memory(&b);
+    bench_clone_free(&b, 0);
+    bench_clone_free(&b, 1);
+    bench_traversal(&b);
+    bench_binary(&b);
+    bench_passes(&b);
+
+    source_unmap(b.source);
+    fclose(b.input);
+    ast_walk_free_stack();
+
+    return 0;
+}
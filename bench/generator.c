@@ -0,0 +1,136 @@
+#include <stdint.h>
+
+#include "generator.h"
+
+typedef struct {
+    FILE *out;
+    const generator_params *params;
+    uint32_t state;
+    size_t bytes;
+} generator;
+
+// xorshift32, such that the output does not depend on the C library.
+static uint32_t gen_random(generator *gen, uint32_t n)
+{
+    gen->state ^= gen->state << 13;
+    gen->state ^= gen->state >> 17;
+    gen->state ^= gen->state << 5;
+
+    return gen->state % n;
+}
+
+#define EMIT(gen, ...) ((gen)->bytes += fprintf((gen)->out, __VA_ARGS__))
+
+static void gen_indent(generator *gen, unsigned int level)
+{
+    EMIT(gen, "%*s", 4 * level, "");
+}
+
+// Emit an integer expression of the given depth over the parameters and locals
+// of the current function and the globals.
+static void gen_expr(generator *gen, unsigned int depth)
+{
+    static const char *ops[] = {"+", "-", "*"};
+
+    if (!depth) {
+        switch (gen_random(gen, 4)) {
+        case 0: EMIT(gen, "%u", gen_random(gen, 100)); break;
+        case 1: EMIT(gen, "%s", gen_random(gen, 2) ? "a" : "b"); break;
+        case 2: EMIT(gen, "%s", gen_random(gen, 2) ? "x" : "y"); break;
+        case 3:
+            if (gen->params->globals)
+                EMIT(gen, "g%u", gen_random(gen, gen->params->globals));
+            else
+                EMIT(gen, "x");
+        break;
+        }
+
+        return;
+    }
+
+    EMIT(gen, "(");
+    gen_expr(gen, depth - 1);
+    EMIT(gen, " %s ", ops[gen_random(gen, 3)]);
+    gen_expr(gen, gen_random(gen, depth));
+    EMIT(gen, ")");
+}
+
+static void gen_function(generator *gen, const char *name, unsigned int nesting,
+        unsigned int level)
+{
+    const generator_params *params = gen->params;
+    unsigned int i;
+    char nested[64];
+
+    gen_indent(gen, level);
+    EMIT(gen, "int %s(int a, int b) {\n", name);
+
+    gen_indent(gen, level + 1);
+    EMIT(gen, "int x = a;\n");
+    gen_indent(gen, level + 1);
+    EMIT(gen, "int y = b;\n");
+
+    if (nesting) {
+        snprintf(nested, sizeof(nested), "%s_n", name);
+        gen_function(gen, nested, nesting - 1, level + 1);
+    }
+
+    for (i = 0; i < params->loops; i++) {
+        gen_indent(gen, level + 1);
+
+        if (i % 2) {
+            EMIT(gen, "while (x < %u) {\n", 100 + i);
+            gen_indent(gen, level + 2);
+            EMIT(gen, "x = x + %u;\n", 1 + i);
+        } else {
+            EMIT(gen, "for (int i%u = 0, %u, %u) {\n", i, 10 + i, 1 + i % 3);
+            gen_indent(gen, level + 2);
+            EMIT(gen, "x = x + i%u;\n", i);
+        }
+
+        gen_indent(gen, level + 2);
+        EMIT(gen, "y = ");
+        gen_expr(gen, params->expr_depth);
+        EMIT(gen, ";\n");
+
+        gen_indent(gen, level + 1);
+        EMIT(gen, "}\n");
+    }
+
+    if (nesting) {
+        gen_indent(gen, level + 1);
+        EMIT(gen, "%s(x, y);\n", nested);
+    }
+
+    gen_indent(gen, level + 1);
+    EMIT(gen, "return ");
+    gen_expr(gen, params->expr_depth);
+    EMIT(gen, ";\n");
+
+    gen_indent(gen, level);
+    EMIT(gen, "}\n");
+}
+
+size_t generate_program(FILE *out, const generator_params *params)
+{
+    generator gen = {
+        .out = out,
+        .params = params,
+        .state = params->seed ? params->seed : 1,
+        .bytes = 0,
+    };
+
+    unsigned int i;
+    char name[32];
+
+    for (i = 0; i < params->globals; i++)
+        EMIT(&gen, "int g%u = %u;\n", i, gen_random(&gen, 1000));
+
+    for (i = 0; i < params->functions; i++) {
+        snprintf(name, sizeof(name), "f%u", i);
+        EMIT(&gen, "export ");
+        gen_function(&gen, name, params->nesting, 0);
+    }
+
+    return gen.bytes;
+}
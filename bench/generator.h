@@ -0,0 +1,23 @@
+#ifndef GUARD_GENERATOR__
+
+#include <stdio.h>
+
+// Shape of a synthetic CiviC program. The same parameters and seed always
+// produce the same program.
+typedef struct {
+    unsigned int globals;
+    unsigned int functions;
+    unsigned int nesting;
+    unsigned int expr_depth;
+    unsigned int loops;
+    unsigned int seed;
+} generator_params;
+
+#define GENERATOR_DEFAULTS \
+    ((generator_params){.globals = 1000, .functions = 200, .nesting = 2, \
+     .expr_depth = 4, .loops = 8, .seed = 42})
+
+size_t generate_program(FILE *out, const generator_params *params);
+
+#define GUARD_GENERATOR__
+#endif
@@ -0,0 +1,15 @@
+OBJECTS := \
+	$(b)civbench.o \
+	$(b)generator.o \
+
+
+$(OBJECTS): CFLAGS := $(CFLAGS) -Isrc/
+
+$(b)civbench: LDFLAGS += -lrt
+$(b)civbench: $(OBJECTS) $(CIVIC_OBJECTS)
+
+# Run with BENCH_FLAGS to change the generated program, e.g.
+#   make bench BENCH_FLAGS="-g 20000 -f 2000"
+.PHONY: bench
+bench: $(b)civbench
+	$(BUILD_DIR)bench/civbench $(BENCH_FLAGS)
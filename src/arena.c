@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+static arena_block *arena_block_new(size_t size, arena_block *next)
+{
+    arena_block *block = malloc(sizeof(arena_block) + size);
+
+    if (!block)
+        return NULL;
+
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+arena *arena_new()
+{
+    arena *a = malloc(sizeof(arena));
+
+    if (!a)
+        return NULL;
+
+    a->head = NULL;
+    a->allocated = 0;
+
+    return a;
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+    arena_block *block;
+
+    if (!a)
+        return NULL;
+
+    size = ARENA_ALIGN(size);
+    block = a->head;
+
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // Keep the current block as head, such that its remaining space is
+        // still used by subsequent small allocations.
+        block = arena_block_new(size, block ? block->next : NULL);
+
+        if (!block)
+            return NULL;
+
+        if (a->head)
+            a->head->next = block;
+        else
+            a->head = block;
+    } else if (!block || block->size - block->used < size) {
+        block = arena_block_new(ARENA_BLOCK_SIZE, block);
+
+        if (!block)
+            return NULL;
+
+        a->head = block;
+    }
+
+    void *ptr = block->data + block->used;
+
+    block->used += size;
+    a->allocated += size;
+
+    return ptr;
+}
+
+char *arena_strdup(arena *a, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(a, len);
+
+    if (!copy)
+        return NULL;
+
+    return memcpy(copy, str, len);
+}
+
+void arena_free(arena *a)
+{
+    arena_block *block, *next;
+
+    if (!a)
+        return;
+
+    for (block = a->head; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    free(a);
+}
@@ -0,0 +1,23 @@
+#ifndef GUARD_ARENA__
+
+#include <stdlib.h>
+
+// Size of a regular arena block. Allocations larger than a quarter of a block
+// get a block of their own, so a big children array does not waste the rest
+// of the current block.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arena_block arena_block;
+
+typedef struct {
+    arena_block *head;
+    size_t allocated;
+} arena;
+
+arena *arena_new();
+void *arena_alloc(arena *a, size_t size);
+char *arena_strdup(arena *a, const char *str);
+void arena_free(arena *a);
+
+#define GUARD_ARENA__
+#endif
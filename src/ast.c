@@ -109,9 +109,119 @@ const char *ast_op_type_name(ast_op_type type)
     return ast_op_type_names[type];
 }
 
+// The state below belongs to the compilation unit that is being compiled by
+// the current thread, so that units can be compiled concurrently.
+
+// When an arena is set, all nodes and children arrays are allocated from it
+// and released at once by arena_free(). Without an arena, every allocation
+// goes through malloc, which keeps valgrind useful.
+static __thread arena *ast_arena = NULL;
+
+// Identifiers of the tree are interned in this table, such that names can be
+// compared by pointer.
+static __thread symbol_table *ast_symbols = NULL;
+
+// Bytes requested for nodes and children arrays, for the statistics.
+static __thread size_t ast_bytes = 0;
+
+// Streams for tree dumps and diagnostics; stdout and stderr when not set.
+static __thread FILE *ast_out = NULL;
+static __thread FILE *ast_err = NULL;
+
+void ast_use_arena(arena *a)
+{
+    ast_arena = a;
+}
+
+void ast_use_symbols(symbol_table *table)
+{
+    ast_symbols = table;
+}
+
+void ast_use_output(FILE *out, FILE *err)
+{
+    ast_out = out;
+    ast_err = err;
+}
+
+FILE *ast_stdout()
+{
+    return ast_out ? ast_out : stdout;
+}
+
+FILE *ast_stderr()
+{
+    return ast_err ? ast_err : stderr;
+}
+
+void *ast_alloc(size_t size)
+{
+    ast_bytes += size;
+
+    if (ast_arena)
+        return arena_alloc(ast_arena, size);
+
+    return malloc(size);
+}
+
+symbol ast_intern_n(const char *str, size_t len)
+{
+    assert(ast_symbols);
+
+    return symbol_intern(ast_symbols, str, len);
+}
+
+symbol ast_intern(const char *str)
+{
+    return ast_intern_n(str, strlen(str));
+}
+
+
+size_t ast_allocated()
+{
+    size_t bytes = ast_bytes;
+
+    if (ast_symbols)
+        bytes += ast_symbols->strings->allocated + ast_symbols->size *
+            sizeof(symbol_entry);
+
+    return bytes;
+}
+
+// Move the children to an array of twice the capacity, or of the needed
+// number of children when that is more. Doubling keeps the copies in arena
+// mode, where the old array cannot be released, linear in the number of
+// children.
+static int ast_children_grow(ast_node *node, size_t needed)
+{
+    uint32_t capacity = 2 * node->capacity;
+
+    if (capacity < needed)
+        capacity = needed;
+
+    size_t size = capacity * sizeof(ast_node *);
+    ast_node **children;
+
+    ast_bytes += size;
+
+    if (!ast_arena && !AST_CHILDREN_INLINE(node))
+        children = realloc(node->children, size);
+    else if ((children = ast_arena ? arena_alloc(ast_arena, size) :
+                malloc(size)))
+        memcpy(children, node->children, node->nary * sizeof(ast_node *));
+
+    if (!children)
+        return 0;
+
+    node->children = children;
+    node->capacity = capacity;
+
+    return 1;
+}
+
 ast_node *ast_new_node(ast_node_type_flag flag, ast_data_type data)
 {
-    ast_node *node = malloc(sizeof(ast_node));
+    ast_node *node = ast_alloc(sizeof(ast_node));
 
     if (!node)
         return NULL;
@@ -119,38 +229,25 @@ ast_node *ast_new_node(ast_node_type_flag flag, ast_data_type data)
     node->type = flag;
     node->data = data;
     node->nary = 0;
-    node->children = NULL;
+    node->capacity = AST_NODE_INLINE;
+    node->offset = AST_OFFSET_NONE;
+    node->children = node->inline_children;
     node->parent = NULL;
+    node->decl = NULL;
 
     return node;
 }
 
 void ast_free_leaf(ast_node *node)
 {
-    if (!node)
+    // Arena allocated nodes are released together with their arena.
+    if (!node || ast_arena)
         return;
 
-    if (node->children)
+    if (!AST_CHILDREN_INLINE(node))
         free(node->children);
 
-    if (node->data.sval) {
-        if (AST_NODE_TYPE(node) == NODE_CONST && AST_DATA_TYPE(node) ==
-                NODE_FLAG_IDENT)
-            free(node->data.sval);
-        else
-            switch (AST_NODE_TYPE(node)) {
-                case NODE_FN_HEAD:
-                case NODE_VAR_DEC:
-                case NODE_VAR_DEF:
-                case NODE_PARAM:
-                case NODE_ASSIGN:
-                case NODE_CALL:
-                case NODE_FOR:
-                    free(node->data.sval);
-                break;
-            }
-    }
-
+    // Identifiers are owned by the symbol table and are not freed here.
     free(node);
 }
 
@@ -158,57 +255,62 @@ void ast_free_node(ast_node *node)
 {
     unsigned int i;
 
-    if (!node)
+    if (!node || ast_arena)
         return;
 
-    if (node->children) {
-        for (i = 0; i < node->nary; i++)
-            ast_free_node(node->children[i]);
-    }
+    for (i = 0; i < node->nary; i++)
+        ast_free_node(node->children[i]);
 
     ast_free_leaf(node);
 }
 
-ast_node *ast_node_clone(ast_node *node)
+size_t ast_node_count(ast_node *node)
 {
+    size_t count = 1;
+    unsigned int i;
+
     if (!node)
-        return NULL;
+        return 0;
 
-    ast_node *new;
+    for (i = 0; i < node->nary; i++)
+        count += ast_node_count(node->children[i]);
 
+    return count;
+}
+
+// Whether data.sval of the node is an identifier.
+int ast_has_symbol(const ast_node *node)
+{
     switch (AST_NODE_TYPE(node)) {
-        case NODE_FN_HEAD:
-        case NODE_VAR_DEC:
-        case NODE_VAR_DEF:
-        case NODE_PARAM:
-        case NODE_ASSIGN:
-        case NODE_CALL:
-        case NODE_FOR:
-            new = ast_new_node(AST_NODE_TYPE(node),
-                    (ast_data_type){.sval = strdup(node->data.sval)});
-        break;
-
-        case NODE_CONST:
-            if (AST_DATA_TYPE(node) == NODE_FLAG_IDENT) {
-                new = ast_new_node(AST_NODE_TYPE(node),
-                    (ast_data_type){.sval = strdup(node->data.sval)});
-
-                break;
-            }
-
-            /* fall through */
-        default:
-            new = ast_new_node(AST_NODE_TYPE(node),
-                    (ast_data_type){.sval = node->data.sval});
-        break;
+    case NODE_FN_HEAD:
+    case NODE_VAR_DEC:
+    case NODE_VAR_DEF:
+    case NODE_PARAM:
+    case NODE_ASSIGN:
+    case NODE_CALL:
+    case NODE_FOR:
+        return 1;
+    case NODE_CONST:
+        return AST_DATA_TYPE(node) == NODE_FLAG_IDENT;
+    default:
+        return 0;
     }
+}
+
+ast_node *ast_node_clone(ast_node *node)
+{
+    if (!node)
+        return NULL;
 
+    ast_node *new = ast_new_node(AST_NODE_TYPE(node), node->data);
 
     if (!new)
         return NULL;
 
     new->type = node->type;
     new->parent = node->parent;
+    new->offset = node->offset;
+    new->decl = node->decl;
 
     unsigned int i;
 
@@ -226,13 +328,9 @@ ast_node *ast_node_append(ast_node *parent, ast_node *child)
     if (!child)
         return parent;
 
-    if (!parent->nary || (parent->nary) % (AST_NODE_BUFFER_SIZE) == 0) {
-        parent->children = realloc(parent->children, (parent->nary +
-                    (AST_NODE_BUFFER_SIZE)) * sizeof(ast_node *));
-
-        if (!parent->children)
-            return NULL;
-    }
+    if (parent->nary == parent->capacity &&
+            !ast_children_grow(parent, parent->nary + 1))
+        return NULL;
 
     parent->children[parent->nary++] = child;
 
@@ -249,13 +347,9 @@ ast_node *ast_node_insert(ast_node *parent, ast_node *child, size_t index)
     if (!child)
         return parent;
 
-    if (!parent->nary || (parent->nary) % (AST_NODE_BUFFER_SIZE) == 0) {
-        parent->children = realloc(parent->children, (parent->nary +
-                    (AST_NODE_BUFFER_SIZE)) * sizeof(ast_node *));
-
-        if (!parent->children)
-            return NULL;
-    }
+    if (parent->nary == parent->capacity &&
+            !ast_children_grow(parent, parent->nary + 1))
+        return NULL;
 
     assert(index <= parent->nary);
 
@@ -271,14 +365,8 @@ ast_node *ast_node_insert(ast_node *parent, ast_node *child, size_t index)
     return parent;
 }
 
-ast_node *ast_node_remove(ast_node *parent, ast_node *node)
+ast_node *ast_node_remove(ast_node *parent, size_t index)
 {
-    size_t index;
-
-    for (index = 0; index < parent->nary; index++)
-        if (parent->children[index] == node)
-            break;
-
     assert(index < parent->nary);
 
     ast_node *child = parent->children[index];
@@ -291,6 +379,13 @@ ast_node *ast_node_remove(ast_node *parent, ast_node *node)
     return child;
 }
 
+// Make room for the given number of children, so that appending them does
+// not reallocate.
+int ast_node_reserve(ast_node *node, size_t capacity)
+{
+    return capacity <= node->capacity || ast_children_grow(node, capacity);
+}
+
 ast_node *ast_flag_set(ast_node *node, unsigned int type)
 {
     if (!node)
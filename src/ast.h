@@ -1,30 +1,52 @@
 #ifndef GUARD_AST_NODE__
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 
-#define AST_NODE_BUFFER_SIZE 16
+#include "arena.h"
+#include "symbol.h"
+
+// Nodes with at most AST_NODE_INLINE children keep them inside the node;
+// larger nodes move them to an array that doubles in size when full.
+#define AST_NODE_INLINE 3
 
 typedef struct ast_node ast_node;
 
 typedef union {
     int ival;
     double dval;
-    char *sval;
+    symbol sval;
     struct ast_node* nval;
 } ast_data_type;
 
+// 72 bytes; with decl, three inline children no longer fit a cache line,
+// but keeping them saves a separate child array for every node with three
+// children. children points either at inline_children or at an array
+// allocated separately. offset is the position of the first token of the
+// node in the source, or AST_OFFSET_NONE for nodes made by passes. decl is
+// the declaration an identifier, call or assignment refers to, as resolved
+// by the context analysis.
 struct ast_node {
     uint32_t type;
     uint32_t nary;
+    uint32_t capacity;
+    uint32_t offset;
     struct ast_node *parent;
     struct ast_node **children;
     ast_data_type data;
+    struct ast_node *decl;
+    struct ast_node *inline_children[AST_NODE_INLINE];
 };
 
+#define AST_OFFSET_NONE UINT32_MAX
+
+#define AST_CHILDREN_INLINE(node) ((node)->children == (node)->inline_children)
+
 #define AST_NODE_TYPE_SHIFT 0
 #define AST_MODIFIER_SHIFT 4
 #define AST_DATA_TYPE_SHIFT 7
+#define AST_EXPR_TYPE_SHIFT 10
 
 typedef enum {
     // Packed in 4 bits
@@ -46,6 +68,8 @@ typedef enum {
     NODE_CONST,
 } ast_node_type_flag;
 
+#define AST_NODE_TYPES 16
+
 typedef enum {
     // Packed in 3 bits
     NODE_FLAG_EXTERN = 1 << AST_MODIFIER_SHIFT,
@@ -65,11 +89,22 @@ typedef enum {
 #define AST_NODE_TYPE_MASK (0xf << AST_NODE_TYPE_SHIFT)
 #define AST_DATA_TYPE_MASK (0x7 << AST_DATA_TYPE_SHIFT)
 #define AST_MODIFIER_MASK (0x7 << AST_MODIFIER_SHIFT)
+#define AST_EXPR_TYPE_MASK (0x7 << AST_EXPR_TYPE_SHIFT)
 
 #define AST_NODE_TYPE(node) ((node)->type & AST_NODE_TYPE_MASK)
 #define AST_DATA_TYPE(node) ((node)->type & AST_DATA_TYPE_MASK)
 #define AST_MODIFIER(node) ((node)->type & AST_MODIFIER_MASK)
 
+// The data type of an expression, as inferred by the context analysis, or
+// zero when it is not known. Packed in 3 bits next to the data type flag.
+#define AST_EXPR_TYPE(node) \
+    ((((node)->type & AST_EXPR_TYPE_MASK) >> AST_EXPR_TYPE_SHIFT) \
+     << AST_DATA_TYPE_SHIFT)
+
+#define AST_EXPR_TYPE_SET(node, data_type) \
+    ((node)->type = ((node)->type & ~AST_EXPR_TYPE_MASK) \
+     | ((data_type) >> AST_DATA_TYPE_SHIFT << AST_EXPR_TYPE_SHIFT))
+
 #define AST_NODE_TYPE_RESET(node, new_type) \
     (node->type = (node)->type & ~AST_NODE_TYPE_MASK & new_type)
 
@@ -103,11 +138,24 @@ typedef enum {
     OP_LOR,
 } ast_op_type;
 
+void ast_use_arena(arena *a);
+void ast_use_symbols(symbol_table *table);
+void ast_use_output(FILE *out, FILE *err);
+FILE *ast_stdout();
+FILE *ast_stderr();
+void *ast_alloc(size_t size);
+size_t ast_allocated();
+symbol ast_intern(const char *str);
+symbol ast_intern_n(const char *str, size_t len);
+
 ast_node *ast_new_node(ast_node_type_flag flag, ast_data_type data);
 ast_node *ast_node_append(ast_node *parent, ast_node *child);
 ast_node *ast_node_insert(ast_node *parent, ast_node *child, size_t index);
-ast_node *ast_node_remove(ast_node *parent, ast_node *node);
+ast_node *ast_node_remove(ast_node *parent, size_t index);
+int ast_node_reserve(ast_node *node, size_t capacity);
 ast_node *ast_node_clone(ast_node *node);
+size_t ast_node_count(ast_node *node);
+int ast_has_symbol(const ast_node *node);
 ast_node *ast_flag_set(ast_node *node, unsigned int type);
 void ast_free_leaf(ast_node *node);
 void ast_free_node(ast_node *node);
@@ -117,46 +165,6 @@ const char *ast_data_type_name(ast_data_type_flag flag);
 const char *ast_node_type_name(ast_node_type_flag flag);
 const char *ast_op_type_name(ast_op_type type);
 
-#define NODE_STACK_SIZE 1024
-
-typedef struct {
-    ast_node **data;
-    unsigned int items;
-    unsigned int size;
-} node_stack;
-
-node_stack *node_stack_new();
-void node_stack_free(node_stack *stack);
-node_stack *node_stack_clone(node_stack *stack);
-void node_stack_push(node_stack *stack, ast_node *node);
-ast_node *node_stack_pop(node_stack *stack);
-int node_stack_empty(node_stack *stack);
-int node_stack_contains(node_stack *stack, ast_node *node);
-
-#define AST_TRAVERSE_START(root, node) \
-    ast_node *node = root; \
-    node_stack *_stack = node_stack_new(); \
-    do {\
-        unsigned int _c; \
-        if (!node) { \
-            if (node_stack_empty(_stack)) \
-                break; \
-            node = node_stack_pop(_stack); \
-            if (!node) \
-                break; \
-        }
-
-#define AST_TRAVERSE_END(root, node) \
-        if (node) { \
-            for (_c = 1; _c < node->nary; _c++) \
-                node_stack_push(_stack, node->children[_c]); \
-            node = node->nary ? node->children[0] : NULL; \
-        } \
-        if (!node && !node_stack_empty(_stack)) \
-            node = node_stack_pop(_stack); \
-    } while(node); \
-    node_stack_free(_stack);
-
 #define NEW_IDENT(val) \
     ast_flag_set(ast_new_node(NODE_CONST, (ast_data_type){.sval = (val)}), \
                  NODE_FLAG_IDENT)
@@ -169,7 +177,7 @@ int node_stack_contains(node_stack *stack, ast_node *node);
     ast_new_node(NODE_BIN_OP, (ast_data_type){.ival = (val)})
 
 #define NEW_BLOCK() \
-    ast_new_node(NODE_FOR, (ast_data_type){.nval = NULL})
+    ast_new_node(NODE_BLOCK, (ast_data_type){.nval = NULL})
 
 #define NEW_FOR() \
     ast_new_node(NODE_FOR, (ast_data_type){.nval = NULL})
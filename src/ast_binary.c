@@ -0,0 +1,376 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ast.h"
+#include "ast_binary.h"
+#include "ast_map.h"
+
+// The nodes start at a cache line, after the header. The children arrays,
+// the offsets of the identifiers and the identifiers themselves follow them.
+#define BINARY_NODES_OFFSET 64
+
+typedef struct {
+    size_t children;
+    size_t string_offsets;
+    size_t strings;
+    size_t size;
+} binary_layout;
+
+static binary_layout binary_layout_of(const ast_binary_header *h)
+{
+    binary_layout l;
+
+    l.children = BINARY_NODES_OFFSET + (size_t) h->node_count *
+        sizeof(ast_node);
+    l.string_offsets = l.children + (size_t) h->child_count *
+        sizeof(ast_node *);
+    l.strings = l.string_offsets + ((size_t) h->string_count + 1) *
+        sizeof(uint32_t);
+    l.size = l.strings + h->strings_size;
+
+    return l;
+}
+
+// A reference to a node of the tree, or zero for none. The nodes are mapped
+// to their number plus one.
+static ast_node *binary_ref(const ast_map *nodes, const ast_node *node)
+{
+    return (ast_node *) (node ? ast_map_lookup(nodes, node) : 0);
+}
+
+static void binary_order(ast_node *node, ast_node **order, size_t *n)
+{
+    unsigned int i;
+
+    order[(*n)++] = node;
+
+    for (i = 0; i < node->nary; i++)
+        binary_order(node->children[i], order, n);
+}
+
+// Write a tree in binary form. Returns zero on failure.
+int ast_binary_write(ast_node *root, FILE *out)
+{
+    size_t count = ast_node_count(root), n = 0, child_count = 0, i, j, c;
+    ast_node **order = malloc(count * sizeof(ast_node *));
+    ast_node *records = calloc(count, sizeof(ast_node));
+    symbol *strings = malloc(count * sizeof(symbol));
+    ast_map nodes = {0}, names = {0};
+    ast_node **children = NULL;
+    uint32_t *string_offsets = NULL;
+    uint32_t string_count = 0, strings_size = 0;
+    int ok = 0;
+
+    if (!order || !records || !strings)
+        goto exit;
+
+    binary_order(root, order, &n);
+
+    for (i = 0; i < count; i++) {
+        uintptr_t *ref = ast_map_get(&nodes, order[i]);
+
+        if (!ref)
+            goto exit;
+
+        *ref = i + 1;
+
+        if (order[i]->nary > AST_NODE_INLINE)
+            child_count += order[i]->nary;
+    }
+
+    if (!(children = malloc((child_count ? child_count : 1) *
+                    sizeof(ast_node *))))
+        goto exit;
+
+    for (i = 0, c = 0; i < count; i++) {
+        ast_node *node = order[i], *record = records + i;
+
+        record->type = node->type;
+        record->nary = node->nary;
+        record->offset = node->offset;
+        record->data = node->data;
+        record->parent = binary_ref(&nodes, node->parent);
+        record->decl = binary_ref(&nodes, node->decl);
+
+        if (ast_has_symbol(node) && node->data.sval) {
+            uintptr_t *ref = ast_map_get(&names, node->data.sval);
+
+            if (!ref)
+                goto exit;
+
+            if (!*ref) {
+                strings[string_count++] = node->data.sval;
+                strings_size += strlen(node->data.sval) + 1;
+                *ref = string_count;
+            }
+
+            record->data.sval = (symbol) *ref;
+        }
+
+        if (node->nary <= AST_NODE_INLINE) {
+            record->capacity = AST_NODE_INLINE;
+
+            for (j = 0; j < node->nary; j++)
+                record->inline_children[j] = binary_ref(&nodes,
+                        node->children[j]);
+        } else {
+            record->capacity = node->nary;
+            record->children = (ast_node **) (uintptr_t) (c + 1);
+
+            for (j = 0; j < node->nary; j++)
+                children[c++] = binary_ref(&nodes, node->children[j]);
+        }
+    }
+
+    if (!(string_offsets = malloc((string_count + 1) * sizeof(uint32_t))))
+        goto exit;
+
+    string_offsets[0] = 0;
+
+    for (i = 0; i < string_count; i++)
+        string_offsets[i + 1] = string_offsets[i] + strlen(strings[i]) + 1;
+
+    ast_binary_header header = {
+        .magic = AST_BINARY_MAGIC,
+        .version = AST_BINARY_VERSION,
+        .node_size = sizeof(ast_node),
+        .node_count = count,
+        .child_count = child_count,
+        .string_count = string_count,
+        .strings_size = strings_size,
+    };
+    char pad[BINARY_NODES_OFFSET - sizeof(ast_binary_header)] = {0};
+
+    ok = fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(pad, sizeof(pad), 1, out) == 1
+        && fwrite(records, sizeof(ast_node), count, out) == count
+        && fwrite(children, sizeof(ast_node *), child_count, out)
+            == child_count
+        && fwrite(string_offsets, sizeof(uint32_t), string_count + 1, out)
+            == string_count + 1;
+
+    for (i = 0; ok && i < string_count; i++)
+        ok = fwrite(strings[i], 1, string_offsets[i + 1] - string_offsets[i],
+                out) == string_offsets[i + 1] - string_offsets[i];
+
+exit:
+    free(order);
+    free(records);
+    free(strings);
+    free(children);
+    free(string_offsets);
+    ast_map_free(&nodes);
+    ast_map_free(&names);
+
+    return ok;
+}
+
+// Write a tree in binary form to a file. Returns zero on failure, with errno
+// set.
+int ast_binary_save(ast_node *root, const char *filename)
+{
+    FILE *out = fopen(filename, "wb");
+    int ok;
+
+    if (!out)
+        return 0;
+
+    ok = ast_binary_write(root, out);
+
+    if (fclose(out))
+        ok = 0;
+
+    return ok;
+}
+
+ast_binary *ast_binary_load(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    ast_binary *image = ast_binary_load_fd(fd);
+    int saved = errno;
+
+    close(fd);
+    errno = saved;
+
+    return image;
+}
+
+// Turn a stored reference into a node, checking that it is in range. A
+// reference of zero is NULL, which is only allowed when optional.
+static int binary_node(ast_node *nodes, uint32_t count, ast_node **ref,
+        int optional)
+{
+    uintptr_t i = (uintptr_t) *ref;
+
+    if (i > count || (!i && !optional))
+        return 0;
+
+    *ref = i ? nodes + i - 1 : NULL;
+
+    return 1;
+}
+
+// Turn the references of a mapped tree into pointers and intern its
+// identifiers. Returns zero when the file is malformed.
+static int binary_relocate(char *data, const ast_binary_header *h,
+        const binary_layout *l)
+{
+    ast_node *nodes = (ast_node *) (data + BINARY_NODES_OFFSET);
+    ast_node **children = (ast_node **) (data + l->children);
+    const uint32_t *string_offsets = (uint32_t *) (data + l->string_offsets);
+    const char *strings = data + l->strings;
+    symbol *symbols = NULL;
+    size_t i, j;
+    int ok = 0;
+
+    if (h->string_count && !(symbols = malloc(h->string_count *
+                    sizeof(symbol))))
+        return 0;
+
+    for (i = 0; i < h->string_count; i++) {
+        uint32_t start = string_offsets[i], end = string_offsets[i + 1];
+
+        if (start >= end || end > h->strings_size)
+            goto exit;
+
+        if (!(symbols[i] = ast_intern_n(strings + start, end - start - 1)))
+            goto exit;
+    }
+
+    for (i = 0; i < h->child_count; i++)
+        if (!binary_node(nodes, h->node_count, children + i, 0))
+            goto exit;
+
+    for (i = 0; i < h->node_count; i++) {
+        ast_node *node = nodes + i;
+
+        if (!binary_node(nodes, h->node_count, &node->parent, 1)
+                || !binary_node(nodes, h->node_count, &node->decl, 1))
+            goto exit;
+
+        if (node->nary <= AST_NODE_INLINE) {
+            node->children = node->inline_children;
+            node->capacity = AST_NODE_INLINE;
+
+            for (j = 0; j < node->nary; j++)
+                if (!binary_node(nodes, h->node_count, node->children + j, 0))
+                    goto exit;
+        } else {
+            uintptr_t c = (uintptr_t) node->children;
+
+            if (!c || c - 1 + node->nary > h->child_count)
+                goto exit;
+
+            node->children = children + c - 1;
+            node->capacity = node->nary;
+        }
+
+        if (ast_has_symbol(node) && node->data.sval) {
+            uintptr_t s = (uintptr_t) node->data.sval;
+
+            if (s > h->string_count)
+                goto exit;
+
+            node->data.sval = symbols[s - 1];
+        }
+    }
+
+    ok = 1;
+
+exit:
+    free(symbols);
+
+    return ok;
+}
+
+// Map a tree in binary form and make it usable in place. The identifiers are
+// interned in the symbol table of the unit. Returns NULL with errno set on
+// failure; a file that is not a tree of this compiler sets EINVAL.
+ast_binary *ast_binary_load_fd(int fd)
+{
+    struct stat st;
+    ast_binary *image;
+    const ast_binary_header *h;
+    binary_layout l;
+
+    if (fstat(fd, &st) < 0)
+        return NULL;
+
+    if (!S_ISREG(st.st_mode) || (size_t) st.st_size < BINARY_NODES_OFFSET) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (!(image = malloc(sizeof(ast_binary))))
+        return NULL;
+
+    image->size = st.st_size;
+    image->data = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fd, 0);
+
+    if (image->data == MAP_FAILED) {
+        free(image);
+        return NULL;
+    }
+
+    h = image->data;
+    l = binary_layout_of(h);
+
+    if (h->magic != AST_BINARY_MAGIC || h->version != AST_BINARY_VERSION
+            || h->node_size != sizeof(ast_node) || !h->node_count
+            || l.size != image->size
+            || !binary_relocate(image->data, h, &l)) {
+        ast_binary_free(image);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    image->root = (ast_node *) ((char *) image->data + BINARY_NODES_OFFSET);
+
+    return image;
+}
+
+// Copy a loaded tree into nodes of its own, with the declarations pointing
+// into the copy, so it can be changed and freed like a parsed tree. The nodes
+// of the copy are in the same pre-order as the mapped nodes.
+ast_node *ast_binary_copy(ast_binary *image)
+{
+    const ast_binary_header *h = image->data;
+    ast_node *root = ast_node_clone(image->root);
+    ast_node **copies = malloc(h->node_count * sizeof(ast_node *));
+    size_t n = 0, i;
+
+    if (!root || !copies || ast_node_count(root) != h->node_count) {
+        free(copies);
+        ast_free_node(root);
+        return NULL;
+    }
+
+    binary_order(root, copies, &n);
+
+    for (i = 0; i < n; i++)
+        if (copies[i]->decl)
+            copies[i]->decl = copies[copies[i]->decl - image->root];
+
+    free(copies);
+
+    return root;
+}
+
+void ast_binary_free(ast_binary *image)
+{
+    if (!image)
+        return;
+
+    munmap(image->data, image->size);
+    free(image);
+}
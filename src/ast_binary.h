@@ -0,0 +1,48 @@
+#ifndef GUARD_AST_BINARY__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+
+// A tree in binary form, which is loaded by mapping it. The file holds the
+// nodes as ast_node records in pre-order, the children arrays of nodes with
+// more than AST_NODE_INLINE children, and the identifiers. References
+// between nodes are stored as indices plus one, and identifiers as their
+// number plus one; loading turns them into pointers in place and interns the
+// identifiers in the symbol table of the unit. The records are only valid
+// for the node layout of the compiler that wrote them, which the header
+// tells.
+#define AST_BINARY_MAGIC 0x54534143
+#define AST_BINARY_VERSION 1
+
+// The file name suffix of trees in binary form.
+#define AST_BINARY_SUFFIX ".ast"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t string_count;
+    uint32_t strings_size;
+    uint32_t reserved;
+} ast_binary_header;
+
+// A loaded tree. The nodes live in the mapping, so it must outlive the tree.
+typedef struct {
+    void *data;
+    size_t size;
+    ast_node *root;
+} ast_binary;
+
+int ast_binary_write(ast_node *root, FILE *out);
+int ast_binary_save(ast_node *root, const char *filename);
+ast_binary *ast_binary_load(const char *filename);
+ast_binary *ast_binary_load_fd(int fd);
+ast_node *ast_binary_copy(ast_binary *image);
+void ast_binary_free(ast_binary *image);
+
+#define GUARD_AST_BINARY__
+#endif
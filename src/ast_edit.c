@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "ast_edit.h"
+
+#define AST_EDIT_LIST_SIZE 16
+
+static int edit_record(ast_edit_list *list, ast_edit_kind kind,
+        ast_node *parent, size_t index, ast_node *node)
+{
+    assert(parent && index <= parent->nary);
+
+    if (list->items == list->size) {
+        size_t size = list->size ? 2 * list->size : AST_EDIT_LIST_SIZE;
+        ast_edit *edits = realloc(list->edits, size * sizeof(ast_edit));
+
+        if (!edits)
+            return 0;
+
+        list->edits = edits;
+        list->size = size;
+    }
+
+    list->edits[list->items] = (ast_edit){
+        .parent = parent,
+        .node = node,
+        .index = index,
+        .seq = list->items,
+        .kind = kind,
+    };
+
+    list->items++;
+
+    return 1;
+}
+
+int ast_edit_insert(ast_edit_list *list, ast_node *parent, size_t index,
+        ast_node *node)
+{
+    return !node || edit_record(list, AST_EDIT_INSERT, parent, index, node);
+}
+
+int ast_edit_append(ast_edit_list *list, ast_node *parent, ast_node *node)
+{
+    return !node || edit_record(list, AST_EDIT_INSERT, parent, parent->nary,
+            node);
+}
+
+int ast_edit_remove(ast_edit_list *list, ast_node *parent, size_t index)
+{
+    assert(index < parent->nary);
+
+    return edit_record(list, AST_EDIT_REMOVE, parent, index, NULL);
+}
+
+int ast_edit_replace(ast_edit_list *list, ast_node *parent, size_t index,
+        ast_node *node)
+{
+    assert(index < parent->nary);
+
+    if (!node)
+        return ast_edit_remove(list, parent, index);
+
+    return edit_record(list, AST_EDIT_REPLACE, parent, index, node);
+}
+
+// Order the edits by parent, then by index, then by the order in which they
+// were recorded.
+static int edit_compare(const void *a, const void *b)
+{
+    const ast_edit *x = a, *y = b;
+
+    if (x->parent != y->parent)
+        return (uintptr_t) x->parent < (uintptr_t) y->parent ? -1 : 1;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Rebuild the children of a node from a copy of them and its edits, sorted
+// by index.
+static int edit_rebuild(ast_edit_list *list, ast_edit *edits, size_t count)
+{
+    ast_node *parent = edits->parent;
+    size_t nary = parent->nary, size = nary, i, e = 0, n = 0;
+
+    for (i = 0; i < count; i++)
+        if (edits[i].kind == AST_EDIT_INSERT)
+            size++;
+
+    if (nary > list->scratch_size) {
+        ast_node **scratch = realloc(list->scratch, nary * sizeof(ast_node *));
+
+        if (!scratch)
+            return 0;
+
+        list->scratch = scratch;
+        list->scratch_size = nary;
+    }
+
+    if (!ast_node_reserve(parent, size))
+        return 0;
+
+    if (nary)
+        memcpy(list->scratch, parent->children, nary * sizeof(ast_node *));
+
+    for (i = 0; i <= nary; i++) {
+        ast_node *child = i < nary ? list->scratch[i] : NULL;
+
+        for (; e < count && edits[e].index == i; e++) {
+            switch (edits[e].kind) {
+                case AST_EDIT_INSERT:
+                    parent->children[n++] = edits[e].node;
+                    edits[e].node->parent = parent;
+                    break;
+                case AST_EDIT_REMOVE:
+                    child = NULL;
+                    break;
+                case AST_EDIT_REPLACE:
+                    child = edits[e].node;
+                    break;
+            }
+        }
+
+        if (child) {
+            parent->children[n++] = child;
+            child->parent = parent;
+        }
+    }
+
+    parent->nary = n;
+
+    return 1;
+}
+
+// Apply and clear the edits. Every edited node is rebuilt once, so applying
+// the list takes time linear in the number of edits and the children of the
+// edited nodes (plus sorting the edits). Returns zero when out of memory.
+int ast_edit_apply(ast_edit_list *list)
+{
+    size_t i, j;
+    int ok = 1;
+
+    if (!list->items)
+        return 1;
+
+    // Edits are mostly recorded in order already.
+    for (i = 1; i < list->items; i++)
+        if (edit_compare(list->edits + i - 1, list->edits + i) > 0)
+            break;
+
+    if (i < list->items)
+        qsort(list->edits, list->items, sizeof(ast_edit), edit_compare);
+
+    for (i = 0; i < list->items; i = j) {
+        for (j = i + 1; j < list->items; j++)
+            if (list->edits[j].parent != list->edits[i].parent)
+                break;
+
+        if (!edit_rebuild(list, list->edits + i, j - i))
+            ok = 0;
+    }
+
+    list->items = 0;
+
+    return ok;
+}
+
+void ast_edit_list_free(ast_edit_list *list)
+{
+    free(list->edits);
+    free(list->scratch);
+    *list = (ast_edit_list){0};
+}
@@ -0,0 +1,50 @@
+#ifndef GUARD_AST_EDIT__
+
+#include <stdint.h>
+
+#include "ast.h"
+
+// A list of pending changes to the children of nodes. Edits refer to the
+// positions of the children when they are recorded, so recording never moves
+// any children around. Applying the list rebuilds the children of each
+// edited node once, which keeps many edits of one block linear.
+typedef enum {
+    // Insert a node in front of the child at the index; at the number of
+    // children, append it. Insertions at one index keep their order.
+    AST_EDIT_INSERT,
+    // Remove the child at the index. The child is not freed.
+    AST_EDIT_REMOVE,
+    // Put a node in the place of the child at the index. The child is not
+    // freed.
+    AST_EDIT_REPLACE,
+} ast_edit_kind;
+
+typedef struct {
+    ast_node *parent;
+    ast_node *node;
+    uint32_t index;
+    uint32_t seq;
+    ast_edit_kind kind;
+} ast_edit;
+
+typedef struct {
+    ast_edit *edits;
+    size_t items;
+    size_t size;
+
+    // Copy of the children of the node that is being rebuilt.
+    ast_node **scratch;
+    size_t scratch_size;
+} ast_edit_list;
+
+int ast_edit_insert(ast_edit_list *list, ast_node *parent, size_t index,
+        ast_node *node);
+int ast_edit_append(ast_edit_list *list, ast_node *parent, ast_node *node);
+int ast_edit_remove(ast_edit_list *list, ast_node *parent, size_t index);
+int ast_edit_replace(ast_edit_list *list, ast_node *parent, size_t index,
+        ast_node *node);
+int ast_edit_apply(ast_edit_list *list);
+void ast_edit_list_free(ast_edit_list *list);
+
+#define GUARD_AST_EDIT__
+#endif
@@ -0,0 +1,113 @@
+#include <assert.h>
+
+#include "ast_frozen.h"
+
+static void freeze_r(ast_frozen *f, ast_node *node, ast_index parent)
+{
+    ast_index i = f->count++;
+    unsigned int c;
+
+    f->links[i] = (ast_frozen_link){
+        .parent = parent,
+        .first_child = node->nary ? i + 1 : AST_INDEX_NONE,
+        .nary = node->nary,
+    };
+    f->type[i] = node->type;
+    f->data[i] = node->data;
+    f->nodes[i] = node;
+
+    for (c = 0; c < node->nary; c++)
+        freeze_r(f, node->children[c], i);
+
+    f->links[i].end = f->count;
+}
+
+// Pack the tree into a frozen copy. The tree must not change while the copy
+// is in use, as the copy points back to its nodes.
+ast_frozen *ast_freeze(ast_node *root)
+{
+    size_t count = ast_node_count(root);
+    ast_frozen *f;
+
+    if (!count || count >= AST_INDEX_NONE)
+        return NULL;
+
+    // One allocation for the header and all columns, largest alignment first.
+    f = malloc(sizeof(ast_frozen) + count * (sizeof(ast_data_type) +
+                sizeof(ast_node *) + sizeof(ast_frozen_link) +
+                sizeof(uint32_t)));
+
+    if (!f)
+        return NULL;
+
+    f->data = (ast_data_type *)(f + 1);
+    f->nodes = (ast_node **)(f->data + count);
+    f->links = (ast_frozen_link *)(f->nodes + count);
+    f->type = (uint32_t *)(f->links + count);
+    f->count = 0;
+
+    freeze_r(f, root, AST_INDEX_NONE);
+
+    assert(f->count == count);
+
+    return f;
+}
+
+void ast_frozen_free(ast_frozen *frozen)
+{
+    free(frozen);
+}
+
+// Index of the n-th child of node i.
+ast_index ast_frozen_child(const ast_frozen *frozen, ast_index i, uint32_t n)
+{
+    ast_index c;
+
+    assert(n < frozen->links[i].nary);
+
+    for (c = frozen->links[i].first_child; n--; c = frozen->links[c].end);
+
+    return c;
+}
+
+static void validate_fn_body(const ast_frozen *f, ast_index i)
+{
+    ast_index c;
+
+    assert(f->links[i].nary == 3 || f->links[i].nary == 4);
+
+    for (c = i + 1; c < f->links[i].end && c < i + 4; c = f->links[c].end)
+        assert(AST_FROZEN_NODE_TYPE(f, c) == NODE_BLOCK);
+}
+
+static void validate_for(const ast_frozen *f, ast_index i)
+{
+    uint32_t nary = f->links[i].nary;
+    uint32_t n = 0;
+    ast_index c;
+
+    assert(nary == 3 || nary == 4);
+
+    AST_FROZEN_FOREACH_CHILD(f, i, c) {
+        if (++n == nary)
+            assert(AST_FROZEN_NODE_TYPE(f, c) == NODE_BLOCK);
+        else {
+            assert(AST_FROZEN_NODE_TYPE(f, c) == NODE_CONST);
+            assert(AST_FROZEN_DATA_TYPE(f, c) == NODE_FLAG_INT);
+        }
+    }
+}
+
+// The checks of ast_validate(), as a single scan over the type column.
+void ast_frozen_validate(const ast_frozen *frozen)
+{
+    ast_index i;
+
+    for (i = 0; i < frozen->count; i++) {
+        switch (AST_FROZEN_NODE_TYPE(frozen, i)) {
+        case NODE_FN_BODY: validate_fn_body(frozen, i); break;
+        case NODE_FOR: validate_for(frozen, i); break;
+        default: break;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef GUARD_AST_FROZEN__
+
+#include <stdint.h>
+
+#include "ast.h"
+
+// A read-only copy of a tree, packed in pre-order into contiguous arrays.
+// Nodes are referred to by their index; the subtree of node i is the range
+// [i, end), its first child is i + 1 and the next sibling of a child c is
+// end of c. The type flags and payload are kept in columns of their own, so
+// scans over them touch nothing else.
+typedef uint32_t ast_index;
+
+#define AST_INDEX_NONE UINT32_MAX
+
+typedef struct {
+    ast_index parent;
+    ast_index first_child;
+    ast_index end;
+    uint32_t nary;
+} ast_frozen_link;
+
+typedef struct {
+    ast_index count;
+    ast_frozen_link *links;
+    uint32_t *type;
+    ast_data_type *data;
+
+    // The node each record was frozen from, for diagnostics.
+    ast_node **nodes;
+} ast_frozen;
+
+#define AST_FROZEN_NODE_TYPE(f, i) ((f)->type[i] & AST_NODE_TYPE_MASK)
+#define AST_FROZEN_DATA_TYPE(f, i) ((f)->type[i] & AST_DATA_TYPE_MASK)
+#define AST_FROZEN_MODIFIER(f, i) ((f)->type[i] & AST_MODIFIER_MASK)
+
+// Iterate over the children c of node i. Leaves have no first child, which
+// is AST_INDEX_NONE and thus never before the end of the subtree.
+#define AST_FROZEN_FOREACH_CHILD(f, i, c) \
+    for ((c) = (f)->links[i].first_child; (c) < (f)->links[i].end; \
+            (c) = (f)->links[c].end)
+
+ast_frozen *ast_freeze(ast_node *root);
+void ast_frozen_free(ast_frozen *frozen);
+ast_index ast_frozen_child(const ast_frozen *frozen, ast_index i, uint32_t n);
+void ast_frozen_validate(const ast_frozen *frozen);
+
+#define GUARD_AST_FROZEN__
+#endif
@@ -5,27 +5,30 @@
 #include "ast.h"
 #include "ast_helpers.h"
 #include "ast_printer.h"
+#include "ast_visitor.h"
+#include "diagnostics.h"
 
-void ast_error(const char *msg, ast_node *node)
+// Report an error about a node in the function with the given head, or in the
+// global scope when it is NULL. The message has one %s, for the node. Errors
+// over the limit of the diagnostics are counted without formatting them.
+void ast_error(const char *msg, ast_node *node, ast_node *scope_node)
 {
-    ast_node *scope_node = find_func_head(node);
-    size_t buflen = 256;
-    char *buf = malloc(buflen * sizeof(char));
+    diagnostics *d = diag_current();
+    char buf[AST_ERROR_SIZE];
 
-    fprintf(stderr, "\x1b[1;31merror:\x1b[0m ");
-    ast_node_format(node, buf, buflen);
-    fprintf(stderr, msg, buf);
+    if (!diag_error(d, node->offset))
+        return;
+
+    ast_node_format(node, buf, sizeof(buf));
+    diag_printf(d, msg, buf);
 
     if (scope_node) {
-        ast_node_format(scope_node, buf, buflen);
-        fprintf(stderr, " in: `%s'.\n", buf);
+        ast_node_format(scope_node, buf, sizeof(buf));
+        diag_printf(d, " in: `%s'.\n", buf);
     } else
-        fprintf(stderr, " in global scope.\n");
-
-    free(buf);
+        diag_printf(d, " in global scope.\n");
 }
 
-
 ast_node *create_global_init(ast_node *root)
 {
     size_t i;
@@ -33,10 +36,12 @@ ast_node *create_global_init(ast_node *root)
     if (!root)
         return NULL;
 
+    symbol init_name = ast_intern("__init");
+
     // Try to find the global function __init.
     for (i = 0; i < root->nary; i++) {
         if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
-                && strncmp(root->children[i]->data.sval, "__init", 7) == 0) {
+                && root->children[i]->data.sval == init_name) {
             assert(root->children[i]->nary == 1);
             return root->children[i]->children[0];
         }
@@ -44,7 +49,7 @@ ast_node *create_global_init(ast_node *root)
 
     // Create the new function __init to initialise the global vars.
     ast_node *__init_head = ast_new_node(NODE_FN_HEAD,
-            (ast_data_type){.sval = strdup("__init")});
+            (ast_data_type){.sval = init_name});
 
     if (!__init_head)
         return NULL;
@@ -90,70 +95,83 @@ ast_node *get_func_body_block(ast_node *fn_body, size_t b)
     return fn_body->children[b];
 }
 
-ast_node *find_func_body(ast_node *node)
+static int has_local(const ast_node *vars, symbol name)
 {
-    if (!node)
-        return NULL;
+    size_t i;
 
-    for (; node->parent; node = node->parent)
-        if (AST_NODE_TYPE(node) == NODE_FN_BODY)
-            return node;
+    for (i = 0; i < vars->nary; i++)
+        if (vars->children[i]->data.sval == name)
+            return 1;
 
-    return NULL;
+    return 0;
 }
 
-ast_node *find_func_head(ast_node *node)
+// Declare a local for a value the compiler keeps, e.g. a hoisted expression.
+// Its name, the prefix with a '$' and a number, cannot be written in CiviC, so
+// it never hides an identifier of the program.
+ast_node *ast_new_local(ast_node *fn_body, const char *prefix,
+        ast_data_type_flag type)
 {
-    if (!node)
-        return NULL;
+    ast_node *vars = get_func_body_block(fn_body, NODE_BLOCK_VARS), *var;
+    char name[AST_LOCAL_NAME_SIZE];
+    size_t n = vars->nary;
+    symbol sym;
+
+    do {
+        snprintf(name, sizeof(name), "%s$%zu", prefix, n++);
 
-    for (; node->parent; node = node->parent)
-        if (AST_NODE_TYPE(node) == NODE_FN_HEAD)
-            return node;
+        if (!(sym = ast_intern(name)))
+            return NULL;
+    } while (has_local(vars, sym));
+
+    if (!(var = ast_flag_set(NEW_VAR_DEC(sym), type)))
+        return NULL;
 
-    return NULL;
+    return ast_node_append(vars, var) ? var : NULL;
 }
 
-int ast_node_pos(ast_node *parent, ast_node *node)
+static ast_visit_result validate_fn_body(ast_walker *walker, ast_node *node)
 {
-    int i;
+    (void) walker;
 
-    for (i = 0; i < (int) parent->nary; i++)
-        if (parent->children[i] == node)
-            return i;
+    assert(node->nary == 3 || node->nary == 4);
 
-    return -1;
+    assert(AST_NODE_TYPE(node->children[0]) == NODE_BLOCK);
+    assert(AST_NODE_TYPE(node->children[1]) == NODE_BLOCK);
+    assert(AST_NODE_TYPE(node->children[2]) == NODE_BLOCK);
+
+    return AST_VISIT_CONTINUE;
 }
 
-void ast_validate(ast_node *root)
+static ast_visit_result validate_for(ast_walker *walker, ast_node *node)
 {
-    AST_TRAVERSE_START(root, node)
-
-    switch (AST_NODE_TYPE(node)) {
-    case NODE_FN_BODY:
-        assert(node->nary == 3 || node->nary == 4);
+    (void) walker;
 
-        assert(AST_NODE_TYPE(node->children[0]) == NODE_BLOCK);
-        assert(AST_NODE_TYPE(node->children[1]) == NODE_BLOCK);
-        assert(AST_NODE_TYPE(node->children[2]) == NODE_BLOCK);
-    break;
+    assert(node->nary == 3 || node->nary == 4);
 
-    case NODE_FOR:
-        assert(node->nary == 3 || node->nary == 4);
+    assert(AST_NODE_TYPE(node->children[0]) == NODE_CONST);
+    assert(AST_DATA_TYPE(node->children[0]) == NODE_FLAG_INT);
+    assert(AST_NODE_TYPE(node->children[1]) == NODE_CONST);
+    assert(AST_DATA_TYPE(node->children[1]) == NODE_FLAG_INT);
 
-        assert(AST_NODE_TYPE(node->children[0]) == NODE_CONST);
-        assert(AST_DATA_TYPE(node->children[0]) == NODE_FLAG_INT);
-        assert(AST_NODE_TYPE(node->children[1]) == NODE_CONST);
-        assert(AST_DATA_TYPE(node->children[1]) == NODE_FLAG_INT);
+    if (node->nary == 4) {
+        assert(AST_NODE_TYPE(node->children[2]) == NODE_CONST);
+        assert(AST_DATA_TYPE(node->children[2]) == NODE_FLAG_INT);
+    }
 
-        if (node->nary == 4) {
-            assert(AST_NODE_TYPE(node->children[2]) == NODE_CONST);
-            assert(AST_DATA_TYPE(node->children[2]) == NODE_FLAG_INT);
-        }
+    assert(AST_NODE_TYPE(node->children[node->nary - 1]) == NODE_BLOCK);
 
-        assert(AST_NODE_TYPE(node->children[node->nary - 1]) == NODE_BLOCK);
-    break;
-    }
+    return AST_VISIT_CONTINUE;
+}
 
-    AST_TRAVERSE_END(root, node)
+void ast_validate(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = {
+            [NODE_FN_BODY] = &validate_fn_body,
+            [NODE_FOR] = &validate_for,
+        },
+    };
+
+    ast_walk(root, &visitor, NULL);
 }
@@ -2,13 +2,17 @@
 
 #include "ast.h"
 
-void ast_error(const char *msg, ast_node *node);
+// Size of the buffers for a formatted node or message of an error.
+#define AST_ERROR_SIZE 256
+
+// Size of the buffer for the name of a local made by the compiler.
+#define AST_LOCAL_NAME_SIZE 64
+
+void ast_error(const char *msg, ast_node *node, ast_node *scope_node);
 ast_node *create_global_init(ast_node *root);
 ast_node *get_func_body_block(ast_node *fn_body, size_t b);
-ast_node *find_func_body(ast_node *node);
-ast_node *find_func_head(ast_node *node);
-
-int ast_node_pos(ast_node *parent, ast_node *node);
+ast_node *ast_new_local(ast_node *fn_body, const char *prefix,
+        ast_data_type_flag type);
 
 void ast_validate(ast_node *root);
 
@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "ast_map.h"
+
+static size_t map_index(const ast_map *map, const void *key)
+{
+    uint64_t hash = (uintptr_t) key * 0x9e3779b97f4a7c15ull;
+    size_t i = (hash >> 32) & (map->size - 1);
+
+    while (map->slots[i].key && map->slots[i].key != key)
+        i = (i + 1) & (map->size - 1);
+
+    return i;
+}
+
+static int map_grow(ast_map *map)
+{
+    size_t size = map->size ? 2 * map->size : AST_MAP_SIZE, i;
+    ast_map old = *map;
+
+    if (!(map->slots = calloc(size, sizeof(ast_map_slot)))) {
+        *map = old;
+        return 0;
+    }
+
+    map->size = size;
+
+    for (i = 0; i < old.size; i++)
+        if (old.slots[i].key)
+            map->slots[map_index(map, old.slots[i].key)] = old.slots[i];
+
+    free(old.slots);
+
+    return 1;
+}
+
+// The value of a key, which is added with value zero when it is absent.
+// Returns NULL when out of memory. The pointer is valid until the next key is
+// added.
+uintptr_t *ast_map_get(ast_map *map, const void *key)
+{
+    size_t i;
+
+    // Keep the map at most half full.
+    if (2 * (map->items + 1) > map->size && !map_grow(map))
+        return NULL;
+
+    i = map_index(map, key);
+
+    if (!map->slots[i].key) {
+        map->slots[i].key = key;
+        map->items++;
+    }
+
+    return &map->slots[i].value;
+}
+
+uintptr_t ast_map_lookup(const ast_map *map, const void *key)
+{
+    if (!map->items)
+        return 0;
+
+    return map->slots[map_index(map, key)].value;
+}
+
+// Make dst hold the keys and values of src, reusing its memory when it is
+// large enough. Returns 0 when out of memory.
+int ast_map_copy(ast_map *dst, const ast_map *src)
+{
+    if (dst->size != src->size) {
+        ast_map_slot *slots = src->size ?
+            malloc(src->size * sizeof(ast_map_slot)) : NULL;
+
+        if (src->size && !slots)
+            return 0;
+
+        free(dst->slots);
+        dst->slots = slots;
+        dst->size = src->size;
+    }
+
+    if (src->size)
+        memcpy(dst->slots, src->slots, src->size * sizeof(ast_map_slot));
+
+    dst->items = src->items;
+
+    return 1;
+}
+
+// Remove all keys, keeping the memory for the next use.
+void ast_map_clear(ast_map *map)
+{
+    if (map->items)
+        memset(map->slots, 0, map->size * sizeof(ast_map_slot));
+
+    map->items = 0;
+}
+
+void ast_map_free(ast_map *map)
+{
+    free(map->slots);
+    *map = (ast_map){0};
+}
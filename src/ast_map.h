@@ -0,0 +1,29 @@
+#ifndef GUARD_AST_MAP__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define AST_MAP_SIZE 64
+
+// A map from pointers, such as nodes or identifiers, to a number, for passes
+// that keep what they learn about declarations while they walk the tree.
+// Absent keys map to zero. A zeroed map is empty.
+typedef struct {
+    const void *key;
+    uintptr_t value;
+} ast_map_slot;
+
+typedef struct {
+    ast_map_slot *slots;
+    size_t items;
+    size_t size;
+} ast_map;
+
+uintptr_t *ast_map_get(ast_map *map, const void *key);
+uintptr_t ast_map_lookup(const ast_map *map, const void *key);
+int ast_map_copy(ast_map *dst, const ast_map *src);
+void ast_map_clear(ast_map *map);
+void ast_map_free(ast_map *map);
+
+#define GUARD_AST_MAP__
+#endif
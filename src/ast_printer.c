@@ -127,9 +127,9 @@ void ast_node_print(const char *msg, ast_node *node)
     size_t i = ast_node_format(node, buf, buflen);
 
     if (i) {
-        printf(msg, buf);
+        fprintf(ast_stdout(), msg, buf);
     } else {
-        printf(msg, "(nil)");
+        fprintf(ast_stdout(), msg, "(nil)");
     }
 
     free(buf);
@@ -156,10 +156,10 @@ static void ast_print_tree_r(ast_node *node, unsigned int level)
     i += ast_node_format(node, buf + i, buflen - i);
 
     if (i > 2 * level) {
-        printf("%s\n", buf);
+        fprintf(ast_stdout(), "%s\n", buf);
     } else {
         buf[i] = 0;
-        printf("%s(nil)\n", buf);
+        fprintf(ast_stdout(), "%s(nil)\n", buf);
     }
 
     if (node->children)
@@ -0,0 +1,242 @@
+#include <assert.h>
+
+#include "ast.h"
+#include "ast_visitor.h"
+
+// The traversal stack is shared by all walks of a thread, so passes do not
+// allocate a stack of their own. A walk started from within another walk gets
+// a private stack.
+static __thread ast_walk_frame *walk_frames = NULL;
+static __thread unsigned int walk_frames_size = 0;
+static __thread int walk_frames_busy = 0;
+
+// Derive the context of a frame from its node and the frame below it.
+static inline void walk_context(ast_walker *walker, unsigned int i)
+{
+    ast_walk_frame *frame = walker->frames + i;
+    unsigned int type = AST_NODE_TYPE(frame->node);
+
+    if (i) {
+        frame->fn_head = frame[-1].fn_head;
+        frame->fn_body = frame[-1].fn_body;
+        frame->scope_depth = frame[-1].scope_depth;
+    } else
+        frame->fn_head = frame->fn_body = frame->scope_depth = 0;
+
+    if (type == NODE_FN_HEAD)
+        frame->fn_head = i + 1;
+    else if (type == NODE_FN_BODY) {
+        frame->fn_body = i + 1;
+        frame->scope_depth++;
+    }
+}
+
+static inline void walk_push(ast_walker *walker, ast_node *node)
+{
+    if (walker->depth >= walker->size) {
+        walker->size = walker->size ? 2 * walker->size : AST_WALK_STACK_SIZE;
+        walker->frames = realloc(walker->frames, walker->size *
+                sizeof(ast_walk_frame));
+
+        assert(walker->frames);
+    }
+
+    walker->frames[walker->depth] = (ast_walk_frame){.node = node,
+        .child = 0};
+    walk_context(walker, walker->depth++);
+}
+
+// Put the replacement of the node on top of the stack in its place. Returns
+// the replacement.
+static ast_node *walk_replace(ast_walker *walker)
+{
+    ast_node *replacement = walker->replacement;
+
+    walker->replacement = NULL;
+
+    if (walker->depth < 2) {
+        assert(replacement);
+        walker->root = replacement;
+        replacement->parent = NULL;
+        walker->frames[0].node = replacement;
+        walk_context(walker, 0);
+
+        return replacement;
+    }
+
+    ast_walk_frame *parent = walker->frames + walker->depth - 2;
+
+    if (!replacement) {
+        if (!ast_edit_remove(&walker->edits, parent->node, parent->child))
+            walker->error = 1;
+
+        return NULL;
+    }
+
+    parent->node->children[parent->child] = replacement;
+    replacement->parent = parent->node;
+    walker->frames[walker->depth - 1].node = replacement;
+    walk_context(walker, walker->depth - 1);
+
+    return replacement;
+}
+
+// Pre-visit a node, and keep visiting replacements. Returns the result of the
+// last pre callback; the node stays on the stack for AST_VISIT_CONTINUE.
+static inline ast_visit_result walk_enter(ast_walker *walker, ast_node *node)
+{
+    ast_visit_result result;
+    ast_visit_fn fn;
+
+    walk_push(walker, node);
+
+    for (;;) {
+        fn = walker->visitor->pre[AST_NODE_TYPE(node) >> AST_NODE_TYPE_SHIFT];
+        result = fn ? fn(walker, node) : AST_VISIT_CONTINUE;
+
+        if (result != AST_VISIT_REPLACE)
+            break;
+
+        if (!(node = walk_replace(walker))) {
+            result = AST_VISIT_SKIP;
+            break;
+        }
+    }
+
+    if (result != AST_VISIT_CONTINUE)
+        walker->depth--;
+
+    return result;
+}
+
+unsigned int ast_walk(ast_node *root, const ast_visitor *visitor, void *data)
+{
+    ast_walker walker = {
+        .visitor = visitor,
+        .data = data,
+        .root = root,
+    };
+
+    ast_visit_result result;
+    ast_visit_fn fn;
+    unsigned int hooked = 0;
+    int i;
+
+    if (!root)
+        return 0;
+
+    // Node types that have a callback.
+    for (i = 0; i < AST_NODE_TYPES; i++)
+        if (visitor->pre[i] || visitor->post[i])
+            hooked |= 1 << i;
+
+    int shared = !walk_frames_busy;
+
+    if (shared) {
+        walk_frames_busy = 1;
+        walker.frames = walk_frames;
+        walker.size = walk_frames_size;
+    }
+
+    result = walk_enter(&walker, root);
+
+    while (walker.depth && result != AST_VISIT_ABORT) {
+        ast_walk_frame *frame = walker.frames + walker.depth - 1;
+        ast_node *node = frame->node;
+
+        while (frame->child < node->nary) {
+            ast_node *child = node->children[frame->child];
+            unsigned int type = AST_NODE_TYPE(child) >> AST_NODE_TYPE_SHIFT;
+
+            // Leaves without callbacks need not go through the stack.
+            if (child->nary || (hooked >> type) & 1)
+                break;
+
+            frame->child++;
+        }
+
+        if (frame->child < node->nary) {
+            result = walk_enter(&walker, node->children[frame->child]);
+
+            // Children that were skipped or removed are done.
+            if (result != AST_VISIT_CONTINUE)
+                walker.frames[walker.depth - 1].child++;
+
+            continue;
+        }
+
+        fn = visitor->post[AST_NODE_TYPE(node) >> AST_NODE_TYPE_SHIFT];
+        result = fn ? fn(&walker, node) : AST_VISIT_CONTINUE;
+
+        if (result == AST_VISIT_REPLACE)
+            walk_replace(&walker);
+
+        if (--walker.depth)
+            walker.frames[walker.depth - 1].child++;
+    }
+
+    if (!ast_edit_apply(&walker.edits))
+        walker.error = 1;
+
+    ast_edit_list_free(&walker.edits);
+
+    if (shared) {
+        walk_frames = walker.frames;
+        walk_frames_size = walker.size;
+        walk_frames_busy = 0;
+    } else
+        free(walker.frames);
+
+    return walker.error;
+}
+
+ast_node *ast_walk_parent(ast_walker *walker)
+{
+    if (walker->depth < 2)
+        return NULL;
+
+    return walker->frames[walker->depth - 2].node;
+}
+
+// The innermost function head around the node that is being visited, or NULL
+// in the global scope.
+ast_node *ast_walk_fn_head(ast_walker *walker)
+{
+    unsigned int i = walker->frames[walker->depth - 1].fn_head;
+
+    return i ? walker->frames[i - 1].node : NULL;
+}
+
+// The innermost function body around the node that is being visited.
+ast_node *ast_walk_fn_body(ast_walker *walker)
+{
+    unsigned int i = walker->frames[walker->depth - 1].fn_body;
+
+    return i ? walker->frames[i - 1].node : NULL;
+}
+
+// The number of function bodies around the node that is being visited; zero
+// in the global scope.
+unsigned int ast_walk_scope_depth(ast_walker *walker)
+{
+    return walker->frames[walker->depth - 1].scope_depth;
+}
+
+// Insert a node in front of the node that is being visited, when the walk is
+// done. The inserted node itself is not visited.
+void ast_walk_insert(ast_walker *walker, ast_node *node)
+{
+    assert(walker->depth >= 2);
+
+    ast_walk_frame *parent = walker->frames + walker->depth - 2;
+
+    if (!ast_edit_insert(&walker->edits, parent->node, parent->child, node))
+        walker->error = 1;
+}
+
+void ast_walk_free_stack()
+{
+    free(walk_frames);
+    walk_frames = NULL;
+    walk_frames_size = 0;
+}
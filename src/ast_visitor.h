@@ -0,0 +1,69 @@
+#ifndef GUARD_AST_VISITOR__
+
+#include "ast.h"
+#include "ast_edit.h"
+
+#define AST_WALK_STACK_SIZE 64
+
+typedef enum {
+    // Visit the children of the node (pre) or carry on with the walk (post).
+    AST_VISIT_CONTINUE,
+    // Do not visit the children of the node and skip its post callback.
+    AST_VISIT_SKIP,
+    // Put walker->replacement in the place of the node. The replacement is
+    // visited in place of the node when returned by a pre callback. A NULL
+    // replacement removes the node from its parent when the walk is done.
+    AST_VISIT_REPLACE,
+    // Stop the walk.
+    AST_VISIT_ABORT,
+} ast_visit_result;
+
+typedef struct ast_walker ast_walker;
+
+typedef ast_visit_result (*ast_visit_fn)(ast_walker *walker, ast_node *node);
+
+// Callbacks per node type, called before (pre) and after (post) the children
+// of a node are visited. Unset callbacks continue the walk.
+typedef struct {
+    ast_visit_fn pre[AST_NODE_TYPES];
+    ast_visit_fn post[AST_NODE_TYPES];
+} ast_visitor;
+
+// A node on the traversal stack, with the context of the traversal at that
+// node: the frames (plus one, zero for none) of the innermost function head
+// and body around it, and the number of function bodies around it. A
+// function head or body is its own innermost head or body.
+typedef struct {
+    ast_node *node;
+    unsigned int child;
+    unsigned int fn_head;
+    unsigned int fn_body;
+    unsigned int scope_depth;
+} ast_walk_frame;
+
+struct ast_walker {
+    const ast_visitor *visitor;
+    void *data;
+    ast_node *root;
+    ast_node *replacement;
+    unsigned int error;
+
+    // Changes to the children of nodes, applied when the walk is done. While
+    // walking, children may only be replaced in place or appended directly.
+    ast_edit_list edits;
+
+    ast_walk_frame *frames;
+    unsigned int depth;
+    unsigned int size;
+};
+
+unsigned int ast_walk(ast_node *root, const ast_visitor *visitor, void *data);
+ast_node *ast_walk_parent(ast_walker *walker);
+ast_node *ast_walk_fn_head(ast_walker *walker);
+ast_node *ast_walk_fn_body(ast_walker *walker);
+unsigned int ast_walk_scope_depth(ast_walker *walker);
+void ast_walk_insert(ast_walker *walker, ast_node *node);
+void ast_walk_free_stack();
+
+#define GUARD_AST_VISITOR__
+#endif
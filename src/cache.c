@@ -0,0 +1,455 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "source.h"
+
+#define CACHE_MAGIC 0x48434143
+#define CACHE_VERSION 1
+
+// Length of the name of an entry: the key in hexadecimal.
+#define CACHE_NAME_SIZE 32
+
+// Eviction removes entries until the cache is at this fraction of its limit,
+// so it does not have to run again for the next few results.
+#define CACHE_LOW_WATER(max) ((max) / 4 * 3)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key_lo;
+    uint64_t key_hi;
+    int32_t exit_code;
+    uint32_t reserved;
+    uint64_t out_size;
+    uint64_t err_size;
+    uint64_t tree_size;
+} cache_header;
+
+struct compile_cache {
+    char *dir;
+    size_t max_size;
+
+    // Identifies the compiler: a hash of its executable.
+    cache_key compiler;
+
+    // Bytes taken by the entries, as far as this process knows, or -1 until
+    // the directory has been scanned.
+    pthread_mutex_t lock;
+    ssize_t size;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long stores;
+    unsigned long evictions;
+};
+
+static uint64_t cache_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+
+    return x;
+}
+
+static uint64_t cache_rotate(uint64_t x, unsigned int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// Two lanes of 64 bits, fed with words of the input and mixed with the length
+// at the end of every update.
+void cache_hash_update(cache_hash *hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t a = hash->a, b = hash->b, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        memcpy(&w, p + i, 8);
+        a = cache_rotate((a ^ w) * 0x9e3779b97f4a7c15ull, 31);
+        b = cache_rotate((b + w) * 0xc2b2ae3d27d4eb4full, 27);
+    }
+
+    if (i < size) {
+        w = 0;
+        memcpy(&w, p + i, size - i);
+        a = cache_rotate((a ^ w) * 0x9e3779b97f4a7c15ull, 31);
+        b = cache_rotate((b + w) * 0xc2b2ae3d27d4eb4full, 27);
+    }
+
+    hash->a = cache_mix(a ^ size);
+    hash->b = cache_mix(b + hash->a);
+}
+
+// Start a key with the compiler, or a key of nothing without a cache.
+void cache_hash_init(cache_hash *hash, const compile_cache *cache)
+{
+    hash->a = CACHE_MAGIC;
+    hash->b = CACHE_VERSION;
+
+    if (cache)
+        cache_hash_update(hash, &cache->compiler, sizeof(cache_key));
+}
+
+cache_key cache_hash_key(const cache_hash *hash)
+{
+    return (cache_key){.lo = hash->a, .hi = hash->b};
+}
+
+// Any change to the compiler changes its executable. Without it, the time
+// this file was compiled at is the best guess.
+static cache_key cache_compiler_key()
+{
+    cache_hash hash = {0};
+    source_file *exe = source_map("/proc/self/exe");
+
+    if (exe) {
+        cache_hash_update(&hash, exe->data, exe->size);
+        source_unmap(exe);
+    } else
+        cache_hash_update(&hash, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+
+    return cache_hash_key(&hash);
+}
+
+// Open the cache in a directory, creating it if needed. Returns NULL with
+// errno set on failure.
+compile_cache *cache_open(const char *dir, size_t max_size)
+{
+    compile_cache *cache;
+
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+        return NULL;
+
+    if (!(cache = calloc(1, sizeof(compile_cache))))
+        return NULL;
+
+    if (!(cache->dir = strdup(dir))) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->max_size = max_size;
+    cache->compiler = cache_compiler_key();
+    cache->size = -1;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void cache_close(compile_cache *cache)
+{
+    if (!cache)
+        return;
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
+
+static char *cache_path(const compile_cache *cache, const cache_key *key)
+{
+    size_t len = strlen(cache->dir) + CACHE_NAME_SIZE + 2;
+    char *path = malloc(len);
+
+    if (path)
+        snprintf(path, len, "%s/%016llx%016llx", cache->dir,
+                (unsigned long long) key->hi, (unsigned long long) key->lo);
+
+    return path;
+}
+
+// Look up the result of a key. Returns zero on a miss; on a hit the entry
+// stays valid until cache_entry_free().
+int cache_lookup(compile_cache *cache, const cache_key *key,
+        cache_entry *entry)
+{
+    char *path = cache_path(cache, key);
+    int fd = path ? open(path, O_RDONLY) : -1;
+    const cache_header *h;
+    struct stat st;
+    int hit = 0;
+
+    *entry = (cache_entry){0};
+
+    if (fd < 0 || fstat(fd, &st) < 0
+            || (size_t) st.st_size < sizeof(cache_header))
+        goto exit;
+
+    entry->size = st.st_size;
+    entry->data = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (entry->data == MAP_FAILED) {
+        entry->data = NULL;
+        goto exit;
+    }
+
+    h = entry->data;
+
+    if (h->magic != CACHE_MAGIC || h->version != CACHE_VERSION
+            || h->key_lo != key->lo || h->key_hi != key->hi
+            || sizeof(cache_header) + h->out_size + h->err_size
+                + h->tree_size != entry->size) {
+        cache_entry_free(entry);
+        goto exit;
+    }
+
+    entry->exit_code = h->exit_code;
+    entry->out = (const char *) (h + 1);
+    entry->out_size = h->out_size;
+    entry->err = entry->out + entry->out_size;
+    entry->err_size = h->err_size;
+    entry->tree = entry->err + entry->err_size;
+    entry->tree_size = h->tree_size;
+
+    // The time of the last use orders the entries for eviction.
+    futimens(fd, NULL);
+    hit = 1;
+
+exit:
+    if (fd >= 0)
+        close(fd);
+
+    free(path);
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (hit)
+        cache->hits++;
+    else
+        cache->misses++;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return hit;
+}
+
+void cache_entry_free(cache_entry *entry)
+{
+    if (entry->data)
+        munmap(entry->data, entry->size);
+
+    *entry = (cache_entry){0};
+}
+
+typedef struct {
+    char name[CACHE_NAME_SIZE + 1];
+    struct timespec used;
+    size_t size;
+} cache_file;
+
+static int cache_file_compare(const void *a, const void *b)
+{
+    const cache_file *x = a, *y = b;
+
+    if (x->used.tv_sec != y->used.tv_sec)
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+
+    return (x->used.tv_nsec > y->used.tv_nsec) -
+        (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+// List the entries in the directory with their sizes and times of last use.
+// Returns the number of entries, or -1 on failure.
+static ssize_t cache_scan(compile_cache *cache, cache_file **files)
+{
+    DIR *dir = opendir(cache->dir);
+    struct dirent *de;
+    struct stat st;
+    size_t count = 0, size = 0;
+
+    *files = NULL;
+
+    if (!dir)
+        return -1;
+
+    while ((de = readdir(dir))) {
+        if (strlen(de->d_name) != CACHE_NAME_SIZE
+                || strspn(de->d_name, "0123456789abcdef") != CACHE_NAME_SIZE
+                || fstatat(dirfd(dir), de->d_name, &st, 0) < 0)
+            continue;
+
+        if (count == size) {
+            size_t new_size = size ? 2 * size : 64;
+            cache_file *new_files = realloc(*files, new_size *
+                    sizeof(cache_file));
+
+            if (!new_files) {
+                closedir(dir);
+                return -1;
+            }
+
+            *files = new_files;
+            size = new_size;
+        }
+
+        memcpy((*files)[count].name, de->d_name, CACHE_NAME_SIZE + 1);
+        (*files)[count].used = st.st_mtim;
+        (*files)[count].size = st.st_size;
+        count++;
+    }
+
+    closedir(dir);
+
+    return count;
+}
+
+// Remove the least recently used entries until the cache is below its low
+// water mark. Called with the lock held.
+static void cache_evict(compile_cache *cache)
+{
+    cache_file *files;
+    ssize_t count = cache_scan(cache, &files), i;
+    size_t size = 0;
+
+    if (count < 0) {
+        free(files);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        size += files[i].size;
+
+    if (size > cache->max_size) {
+        int fd = open(cache->dir, O_RDONLY | O_DIRECTORY);
+
+        qsort(files, count, sizeof(cache_file), cache_file_compare);
+
+        for (i = 0; fd >= 0 && i < count
+                && size > CACHE_LOW_WATER(cache->max_size); i++) {
+            if (!unlinkat(fd, files[i].name, 0)) {
+                size -= files[i].size;
+                cache->evictions++;
+            }
+        }
+
+        if (fd >= 0)
+            close(fd);
+    }
+
+    cache->size = size;
+    free(files);
+}
+
+static int cache_write(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+
+    while (size) {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return 0;
+
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+// Store the result of a key, replacing any entry it had. Returns zero on
+// failure, which leaves the cache as it was.
+int cache_store(compile_cache *cache, const cache_key *key,
+        const cache_entry *entry)
+{
+    cache_header h = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .key_lo = key->lo,
+        .key_hi = key->hi,
+        .exit_code = entry->exit_code,
+        .out_size = entry->out_size,
+        .err_size = entry->err_size,
+        .tree_size = entry->tree_size,
+    };
+    size_t size = sizeof(h) + h.out_size + h.err_size + h.tree_size;
+    size_t len = strlen(cache->dir) + sizeof("/.tmp.XXXXXX");
+    char *path = cache_path(cache, key), *tmp = malloc(len);
+    int fd = -1, ok = 0;
+
+    if (!path || !tmp)
+        goto exit;
+
+    snprintf(tmp, len, "%s/.tmp.XXXXXX", cache->dir);
+
+    if ((fd = mkstemp(tmp)) < 0)
+        goto exit;
+
+    ok = cache_write(fd, &h, sizeof(h))
+        && cache_write(fd, entry->out, entry->out_size)
+        && cache_write(fd, entry->err, entry->err_size)
+        && cache_write(fd, entry->tree, entry->tree_size);
+
+    if (close(fd) < 0)
+        ok = 0;
+
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        ok = 0;
+        goto exit;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    cache->stores++;
+
+    // Replacing an entry is counted twice until the next scan, which only
+    // makes eviction start early.
+    if (cache->size >= 0)
+        cache->size += size;
+
+    if (cache->size < 0 || (size_t) cache->size > cache->max_size)
+        cache_evict(cache);
+
+    pthread_mutex_unlock(&cache->lock);
+
+exit:
+    free(path);
+    free(tmp);
+
+    return ok;
+}
+
+void cache_print_stats(compile_cache *cache, FILE *out, int json)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->size < 0) {
+        cache_file *files;
+        ssize_t count = cache_scan(cache, &files), i;
+
+        for (i = 0, cache->size = 0; i < count; i++)
+            cache->size += files[i].size;
+
+        free(files);
+    }
+
+    if (json)
+        fprintf(out, "{\"cache\": {\"hits\": %lu, \"misses\": %lu, "
+                "\"stores\": %lu, \"evictions\": %lu, \"bytes\": %zd, "
+                "\"max_bytes\": %zu}}\n", cache->hits, cache->misses,
+                cache->stores, cache->evictions, cache->size,
+                cache->max_size);
+    else
+        fprintf(out, "cache: %lu hits, %lu misses, %lu stores, %lu "
+                "evictions, %zd of %zu bytes\n", cache->hits, cache->misses,
+                cache->stores, cache->evictions, cache->size,
+                cache->max_size);
+
+    pthread_mutex_unlock(&cache->lock);
+}
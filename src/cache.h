@@ -0,0 +1,63 @@
+#ifndef GUARD_CACHE__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// An on-disk cache of compilation results, shared by the units of a process
+// and by processes using the same directory. Each result is a file named by
+// its key, which is a hash of everything the result depends on: the compiler
+// itself, the options, the file name and the source. Results are written to
+// a temporary file and renamed, so readers never see partial entries. When
+// the files take more than the size limit, the least recently used ones are
+// removed.
+#define CACHE_MAX_SIZE (256u << 20)
+
+// The largest size limit, in MiB, whose size in bytes fits a size_t.
+#define CACHE_MAX_MIB ((long) (SIZE_MAX >> 20))
+
+typedef struct compile_cache compile_cache;
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+} cache_key;
+
+// The key being computed for a result. Every update is delimited, so the
+// same bytes split differently give a different key.
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+} cache_hash;
+
+// The result of compiling one file: the exit code, what was written to
+// stdout and stderr, and the tree written with -w, if any. Looked up entries
+// point into data.
+typedef struct {
+    int exit_code;
+    const char *out;
+    size_t out_size;
+    const char *err;
+    size_t err_size;
+    const char *tree;
+    size_t tree_size;
+
+    void *data;
+    size_t size;
+} cache_entry;
+
+compile_cache *cache_open(const char *dir, size_t max_size);
+void cache_close(compile_cache *cache);
+
+void cache_hash_init(cache_hash *hash, const compile_cache *cache);
+void cache_hash_update(cache_hash *hash, const void *data, size_t size);
+cache_key cache_hash_key(const cache_hash *hash);
+
+int cache_lookup(compile_cache *cache, const cache_key *key,
+        cache_entry *entry);
+void cache_entry_free(cache_entry *entry);
+int cache_store(compile_cache *cache, const cache_key *key,
+        const cache_entry *entry);
+void cache_print_stats(compile_cache *cache, FILE *out, int json);
+
+#define GUARD_CACHE__
+#endif
@@ -1,39 +1,78 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "ast.h"
+#include "ast_binary.h"
 #include "ast_helpers.h"
 #include "ast_printer.h"
+#include "ast_visitor.h"
+#include "cache.h"
+#include "diagnostics.h"
+#include "parser.h"
+#include "symbol.h"
 #include "phases.h"
+#include "stats.h"
 
 const char *usage_msg =
-"Usage: %s [OPTIONS] <civic_file>\n"
+"Usage: %s [OPTIONS] <civic_file>...\n"
 "\n"
 "Options:\n"
-"  -b  Print bison parser debug information to stdout.\n"
-"  -t  Dump AST tree to stdout.\n"
+"  -b    Print bison parser debug information to stderr.\n"
+"  -c D  Cache the results of files in directory D.\n"
+"  -C N  Limit the cache to N MiB (default 256).\n"
+"  -e N  Report at most N errors per file (default 100, 0 for all).\n"
+"  -i N  Inline calls of functions whose statements and result take at most\n"
+"        N nodes (default 32, 0 to not inline).\n"
+"  -I N  Nest inlined calls at most N deep (default 3).\n"
+"  -j N  Compile up to N files concurrently (default 1).\n"
+"  -m    Allocate every node with malloc instead of an arena (for valgrind).\n"
+"  -s    Print the time, nodes and memory used per pass to stderr.\n"
+"  -S    Like -s, but print the report as JSON.\n"
+"  -t    Dump AST tree to stdout.\n"
+"  -u N  Unroll for-loops whose copies of the body take at most N nodes\n"
+"        (default 128, 0 to not unroll).\n"
+"  -U N  Unroll longer for-loops N times (default 4).\n"
+"  -w    Write the analysed tree of each file to <civic_file>.ast.\n"
+"\n"
+"With -c, a file whose contents, name and options match a cached result is\n"
+"not compiled; the output and exit code of the result are reused. -s and -S\n"
+"then also report the hits and misses of the cache.\n"
+"\n"
+"Files ending in .ast are trees written with -w. They are loaded by mapping\n"
+"them, and compiled from the phases after the analysis on.\n"
+"\n"
+"The output of each file is printed in the order of the files, also when\n"
+"they are compiled concurrently. The exit code is the highest exit code of\n"
+"all files.\n"
 ;
 
-extern int yyparse(ast_node *root);
-extern int yylex_destroy();
 extern int yydebug;
-extern FILE *yyin;
 
 #define DECLARE_PHASE(name) \
     unsigned int name##_tree(ast_node *root, int dump_ast) \
     { \
-        size_t i; \
         unsigned int error = 0; \
     \
         if (dump_ast) { \
-            printf("=== " #name " tree ===\n"); \
+            fprintf(ast_stdout(), "=== " #name " tree ===\n"); \
             ast_print_tree(root); \
         } \
     \
-        for (i = 0; i < sizeof(name##_passes) / sizeof(pass_fn); i++) \
-            error |= name##_passes[i](root); \
+        error |= pass_manager_run(#name, name##_passes, \
+                sizeof(name##_passes) / sizeof(pass_info), root); \
+    \
+        stats_record *record = stats_enabled() ? \
+            stats_begin(#name, "validate", root) : NULL; \
     \
         ast_validate(root); \
+    \
+        if (record) \
+            stats_end(record, root); \
     \
         return error; \
     }
@@ -42,64 +81,221 @@ COMPILER_PHASES
 DECLARE_PHASE(preprocess)
 DECLARE_PHASE(analyse)
 DECLARE_PHASE(loops)
+DECLARE_PHASE(optimize)
 
-ast_node *parse_file(const char *filename)
+// Parse a file, or its contents when they are mapped already.
+ast_node *parse_file(const char *filename, source_file *source)
 {
     ast_node *root;
+    stats_record *record = NULL;
+    parse_context *ctx = source ? parse_context_new_source(source) :
+        parse_context_new(filename);
 
-    if (strncmp(filename, "-", 2) == 0)
-        yyin = stdin;
-    else
-        yyin = fopen(filename, "r");
-
-    if (!yyin) {
-        perror("fopen");
+    if (!ctx)
         return NULL;
+
+    ctx->filename = filename;
+
+    if (stats_enabled())
+        record = stats_begin("parse", "parse", NULL);
+
+    root = parse_context_run(ctx);
+
+    if (record)
+        stats_end(record, ctx->root);
+
+    // Errors about the tree are located with the lines the scanner found.
+    if (diag_current()) {
+        diag_set_lines(diag_current(), ctx->lines, ctx->line_count);
+        ctx->lines = NULL;
     }
 
-    root = ast_new_node(NODE_BLOCK, (ast_data_type){.sval = NULL});
+    parse_context_free(ctx);
 
-    int result = yyparse(root);
+    return root;
+}
+
+typedef struct {
+    const char *filename;
+    int exit_code;
+    int done;
+
+    // Output of the file, buffered when files are compiled concurrently.
+    char *out;
+    size_t out_size;
+    char *err;
+    size_t err_size;
+} unit;
+
+typedef struct {
+    int dump_ast;
+    int use_malloc;
+    int write_ast;
+    unsigned int max_errors;
+    unsigned int unroll_limit;
+    unsigned int unroll_factor;
+    unsigned int inline_limit;
+    unsigned int inline_depth;
+    compile_cache *cache;
+} compile_options;
+
+typedef struct {
+    unit *units;
+    size_t count;
+    size_t next;
+    size_t flushed;
+    compile_options options;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} unit_queue;
 
-    fclose(yyin);
+static int has_suffix(const char *str, const char *suffix)
+{
+    size_t len = strlen(str), n = strlen(suffix);
+
+    return len >= n && !strcmp(str + len - n, suffix);
+}
 
-    yylex_destroy();
+// Load a tree written with -w, which has been preprocessed and analysed
+// already. The mapped nodes can only be changed with an arena, which never
+// frees or reallocates them, so with -m the tree is copied into nodes of its
+// own.
+static ast_node *load_file(const char *filename, ast_binary **image,
+        int use_malloc)
+{
+    ast_node *root;
+    stats_record *record = stats_enabled() ?
+        stats_begin("load", "load", NULL) : NULL;
 
-    if (result)
+    if (!(*image = ast_binary_load(filename))) {
+        fprintf(ast_stderr(), "%s: %s\n", filename, strerror(errno));
         return NULL;
+    }
+
+    root = (*image)->root;
+
+    if (record)
+        stats_end(record, root);
+
+    if (use_malloc) {
+        if (!(root = ast_binary_copy(*image)))
+            perror("ast_binary_copy");
+
+        ast_binary_free(*image);
+        *image = NULL;
+    }
 
     return root;
 }
 
-int main(int argc, const char *argv[])
+// The name of the tree written with -w for a file. Returns NULL when out of
+// memory.
+static char *tree_filename(const char *filename)
 {
-    int i;
-    ast_node *root;
+    size_t len = strlen(filename);
+    char *out = malloc(len + sizeof(AST_BINARY_SUFFIX));
+
+    if (out) {
+        memcpy(out, filename, len);
+        memcpy(out + len, AST_BINARY_SUFFIX, sizeof(AST_BINARY_SUFFIX));
+    }
+
+    return out;
+}
+
+// Write the tree of a file for -w, or into a stream when given one. Returns
+// zero after reporting a failure.
+static int write_tree(const char *filename, ast_node *root, FILE *stream)
+{
+    char *out;
+    int ok;
+
+    if (stream)
+        return ast_binary_write(root, stream);
+
+    out = tree_filename(filename);
+    ok = out && ast_binary_save(root, out);
+
+    if (!ok)
+        fprintf(ast_stderr(), "%s: %s\n", out ? out : filename,
+                strerror(errno));
+
+    free(out);
+
+    return ok;
+}
+
+// Write a tree for -w that is in memory already.
+static int write_tree_data(const char *filename, const char *data,
+        size_t size)
+{
+    char *out = tree_filename(filename);
+    FILE *file = out ? fopen(out, "wb") : NULL;
+    int ok = file && fwrite(data, 1, size, file) == size;
+
+    if (file && fclose(file))
+        ok = 0;
+
+    if (!ok)
+        fprintf(ast_stderr(), "%s: %s\n", out ? out : filename,
+                strerror(errno));
 
-    int dump_ast = 0;
+    free(out);
+
+    return ok;
+}
+
+// Compile one file with a symbol table, an arena and diagnostics of its own.
+// The source is parsed from the mapping when given, and the tree for -w is
+// written into the tree stream when given. Returns the exit code of the file.
+static int compile_unit(const char *filename, source_file *source,
+        const compile_options *options, FILE *tree)
+{
+    ast_node *root;
+    arena *ast_mem = NULL;
+    ast_binary *image = NULL;
+    symbol_table *symbols;
+    diagnostics diag;
+    int dump_ast = options->dump_ast;
     int exit_code = 0;
 
-    if (argc < 2) {
-        printf(usage_msg, argv[0]);
+    if (!(symbols = symbol_table_new())) {
+        perror("symbol_table_new");
         return 1;
     }
 
-    for (i = 1; i < argc - 1; i++) {
-        if (argv[i][0] == '-') {
-            if (strlen(argv[i]) == 1)
-                break;
+    ast_use_symbols(symbols);
 
-            switch (argv[i][1]) {
-                case 'b': yydebug = 1; break;
-                case 't': dump_ast = 1; break;
-            }
+    if (!options->use_malloc) {
+        if (!(ast_mem = arena_new())) {
+            perror("arena_new");
+            symbol_table_free(symbols);
+            return 1;
         }
     }
 
-    root = parse_file(argv[i]);
+    ast_use_arena(ast_mem);
 
-    if (!root)
-        return 1;
+    diag_init(&diag, filename, options->max_errors);
+    diag_use(&diag);
+
+    if (has_suffix(filename, AST_BINARY_SUFFIX)) {
+        if (!(root = load_file(filename, &image,
+                        options->use_malloc))) {
+            exit_code = 1;
+            goto exit;
+        }
+
+        goto analysed;
+    }
+
+    root = parse_file(filename, source);
+
+    if (!root) {
+        exit_code = 1;
+        goto exit;
+    }
 
     if (preprocess_tree(root, dump_ast)) {
         exit_code = 2;
@@ -111,18 +307,414 @@ int main(int argc, const char *argv[])
         goto exit;
     }
 
+    if (options->write_ast && !write_tree(filename, root, tree)) {
+        exit_code = 1;
+        goto exit;
+    }
+
+analysed:
     if (loops_tree(root, dump_ast)) {
         exit_code = 4;
         goto exit;
     }
 
+    if (optimize_tree(root, dump_ast)) {
+        exit_code = 5;
+        goto exit;
+    }
+
     if (dump_ast) {
-        printf("=== output tree ===\n");
+        fprintf(ast_stdout(), "=== output tree ===\n");
         ast_print_tree(root);
     }
 
 exit:
-    ast_free_node(root);
+    diag_flush(&diag, ast_stderr());
+    diag_use(NULL);
+    diag_free(&diag);
+
+    // The arena releases the whole tree at once; the per-node path is only
+    // taken with -m. A loaded tree is released with its mapping, after the
+    // arena since nodes in the arena may point into it.
+    if (ast_mem)
+        arena_free(ast_mem);
+    else
+        ast_free_node(root);
+
+    ast_binary_free(image);
+
+    ast_use_arena(NULL);
+    ast_use_symbols(NULL);
+    symbol_table_free(symbols);
+
+    return exit_code;
+}
+
+// The key of the result of a file: everything its output depends on. The
+// file name is part of it, as diagnostics name the file.
+static cache_key compile_key(const char *filename, source_file *source,
+        const compile_options *options)
+{
+    cache_hash hash;
+
+    cache_hash_init(&hash, options->cache);
+    cache_hash_update(&hash, &options->dump_ast, sizeof(options->dump_ast));
+    cache_hash_update(&hash, &options->write_ast, sizeof(options->write_ast));
+    cache_hash_update(&hash, &options->max_errors,
+            sizeof(options->max_errors));
+    cache_hash_update(&hash, &options->unroll_limit,
+            sizeof(options->unroll_limit));
+    cache_hash_update(&hash, &options->unroll_factor,
+            sizeof(options->unroll_factor));
+    cache_hash_update(&hash, &options->inline_limit,
+            sizeof(options->inline_limit));
+    cache_hash_update(&hash, &options->inline_depth,
+            sizeof(options->inline_depth));
+    cache_hash_update(&hash, filename, strlen(filename));
+    cache_hash_update(&hash, source->data, source->size);
+
+    return cache_hash_key(&hash);
+}
+
+// Compile a file and store its output in the cache. The output is captured
+// while compiling and written once the unit is done.
+static int compile_cached(const char *filename, source_file *source,
+        const compile_options *options, const cache_key *key)
+{
+    FILE *out = ast_stdout(), *err = ast_stderr();
+    char *out_buf = NULL, *err_buf = NULL, *tree_buf = NULL;
+    cache_entry entry = {0};
+    FILE *capture_out = open_memstream(&out_buf, &entry.out_size);
+    FILE *capture_err = open_memstream(&err_buf, &entry.err_size);
+    FILE *tree = options->write_ast ?
+        open_memstream(&tree_buf, &entry.tree_size) : NULL;
+    int ok = capture_out && capture_err && (tree || !options->write_ast);
+
+    if (ok) {
+        ast_use_output(capture_out, capture_err);
+        entry.exit_code = compile_unit(filename, source, options, tree);
+        ast_use_output(out, err);
+    }
+
+    if (capture_out && fclose(capture_out))
+        ok = 0;
+
+    if (capture_err && fclose(capture_err))
+        ok = 0;
+
+    if (tree && fclose(tree))
+        ok = 0;
+
+    if (!ok) {
+        free(out_buf);
+        free(err_buf);
+        free(tree_buf);
+
+        return compile_unit(filename, source, options, NULL);
+    }
+
+    entry.out = out_buf;
+    entry.err = err_buf;
+    entry.tree = tree_buf;
+
+    cache_store(options->cache, key, &entry);
+
+    fwrite(entry.out, 1, entry.out_size, out);
+    fwrite(entry.err, 1, entry.err_size, err);
+
+    if (entry.tree_size && !write_tree_data(filename, entry.tree,
+                entry.tree_size) && !entry.exit_code)
+        entry.exit_code = 1;
+
+    free(out_buf);
+    free(err_buf);
+    free(tree_buf);
+
+    return entry.exit_code;
+}
+
+// Compile one file, or reuse its cached result. Returns the exit code of the
+// file.
+static int compile_file(const char *filename, const compile_options *options)
+{
+    source_file *source = NULL;
+    cache_entry entry;
+    cache_key key;
+    int exit_code;
+
+    // Only regular source files are cached: stdin cannot be read twice, and
+    // loading a tree is as fast as a lookup.
+    if (!options->cache || !strcmp(filename, "-")
+            || has_suffix(filename, AST_BINARY_SUFFIX)
+            || !(source = source_map(filename))) {
+        exit_code = compile_unit(filename, NULL, options, NULL);
+        goto exit;
+    }
+
+    key = compile_key(filename, source, options);
+
+    if (!cache_lookup(options->cache, &key, &entry)) {
+        exit_code = compile_cached(filename, source, options, &key);
+        goto exit;
+    }
+
+    fwrite(entry.out, 1, entry.out_size, ast_stdout());
+    fwrite(entry.err, 1, entry.err_size, ast_stderr());
+    exit_code = entry.exit_code;
+
+    if (entry.tree_size && !write_tree_data(filename, entry.tree,
+                entry.tree_size) && !exit_code)
+        exit_code = 1;
+
+    cache_entry_free(&entry);
+
+exit:
+    source_unmap(source);
+
+    stats_print(ast_stderr());
+    stats_free();
+
+    return exit_code;
+}
+
+static void *compile_worker(void *arg)
+{
+    unit_queue *queue = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (i >= queue->count)
+            break;
+
+        unit *u = queue->units + i;
+        FILE *out = open_memstream(&u->out, &u->out_size);
+        FILE *err = open_memstream(&u->err, &u->err_size);
+
+        if (!out || !err) {
+            perror("open_memstream");
+            u->exit_code = 1;
+        } else {
+            ast_use_output(out, err);
+            u->exit_code = compile_file(u->filename, &queue->options);
+            ast_use_output(NULL, NULL);
+        }
+
+        if (out)
+            fclose(out);
+
+        if (err)
+            fclose(err);
+
+        pthread_mutex_lock(&queue->lock);
+        u->done = 1;
+        pthread_cond_broadcast(&queue->done);
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    ast_walk_free_stack();
+
+    return NULL;
+}
+
+// Compile the files on a pool of worker threads. The output of each file is
+// printed as soon as it and all files before it are done, so it comes out in
+// the order of the files.
+static void compile_files(unit_queue *queue, unsigned int jobs)
+{
+    pthread_t *workers = malloc(jobs * sizeof(pthread_t));
+    unsigned int i, started = 0;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->done, NULL);
+
+    for (i = 0; workers && i < jobs; i++, started++)
+        if (pthread_create(workers + i, NULL, compile_worker, queue))
+            break;
+
+    // Without any worker, compile everything on this thread.
+    if (!started)
+        compile_worker(queue);
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->flushed < queue->count) {
+        unit *u = queue->units + queue->flushed;
+
+        if (!u->done) {
+            pthread_cond_wait(&queue->done, &queue->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+
+        fwrite(u->out, 1, u->out_size, stdout);
+        fwrite(u->err, 1, u->err_size, stderr);
+        free(u->out);
+        free(u->err);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->flushed++;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    pthread_cond_destroy(&queue->done);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+// Reads the value of the option at argv[*i], given either right after it as
+// in -j4 or as the next argument, as a decimal number from min to max.
+// Returns 0 when the value is missing or not such a number.
+static int number_option(int argc, const char *argv[], int *i, long min,
+        long max, long *value)
+{
+    const char *arg = argv[*i][2] ? argv[*i] + 2
+        : *i + 1 < argc ? argv[++*i] : NULL;
+    char *end;
+
+    if (!arg || !*arg)
+        return 0;
+
+    errno = 0;
+    *value = strtol(arg, &end, 10);
+
+    return !errno && !*end && *value >= min && *value <= max;
+}
+
+int main(int argc, const char *argv[])
+{
+    int i;
+    unsigned int jobs = 1;
+    size_t j;
+    unit_queue queue = {
+        .options.max_errors = DIAG_MAX_ERRORS,
+        .options.unroll_limit = UNROLL_LIMIT,
+        .options.unroll_factor = UNROLL_FACTOR,
+        .options.inline_limit = INLINE_LIMIT,
+        .options.inline_depth = INLINE_DEPTH,
+    };
+    const char *cache_dir = NULL;
+    size_t cache_size = CACHE_MAX_SIZE;
+    int exit_code = 0;
+    long n;
+
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        switch (argv[i][1]) {
+            case 'b': yydebug = 1; break;
+            case 'm': queue.options.use_malloc = 1; break;
+            case 's': stats_enable(STATS_TABLE); break;
+            case 'S': stats_enable(STATS_JSON); break;
+            case 't': queue.options.dump_ast = 1; break;
+            case 'w': queue.options.write_ast = 1; break;
+            case 'e':
+                if (!number_option(argc, argv, &i, 0, INT_MAX, &n))
+                    goto usage;
+                queue.options.max_errors = n;
+                break;
+            case 'u':
+                if (!number_option(argc, argv, &i, 0, INT_MAX, &n))
+                    goto usage;
+                queue.options.unroll_limit = n;
+                break;
+            case 'U':
+                if (!number_option(argc, argv, &i, 0, INT_MAX, &n))
+                    goto usage;
+                queue.options.unroll_factor = n;
+                break;
+            case 'i':
+                if (!number_option(argc, argv, &i, 0, INT_MAX, &n))
+                    goto usage;
+                queue.options.inline_limit = n;
+                break;
+            case 'I':
+                if (!number_option(argc, argv, &i, 0, INT_MAX, &n))
+                    goto usage;
+                queue.options.inline_depth = n;
+                break;
+            case 'c':
+                if (argv[i][2])
+                    cache_dir = argv[i] + 2;
+                else if (i + 1 < argc)
+                    cache_dir = argv[++i];
+                break;
+            case 'C':
+                if (!number_option(argc, argv, &i, 0, CACHE_MAX_MIB, &n))
+                    goto usage;
+                cache_size = (size_t) n << 20;
+                break;
+            case 'j':
+                if (!number_option(argc, argv, &i, 1, INT_MAX, &n))
+                    goto usage;
+                jobs = n;
+                break;
+        }
+    }
+
+    if (i >= argc) {
+usage:
+        printf(usage_msg, argv[0]);
+        return 1;
+    }
+
+    loops_set_unroll(queue.options.unroll_limit, queue.options.unroll_factor);
+    optimize_set_inline(queue.options.inline_limit,
+            queue.options.inline_depth);
+
+    // Parser debug output goes around the captured output of a unit, so it
+    // cannot be cached.
+    if (cache_dir && !yydebug && !(queue.options.cache =
+                cache_open(cache_dir, cache_size))) {
+        fprintf(stderr, "%s: %s\n", cache_dir, strerror(errno));
+        return 1;
+    }
+
+    queue.count = argc - i;
+
+    if (!(queue.units = calloc(queue.count, sizeof(unit)))) {
+        perror("calloc");
+        return 1;
+    }
+
+    for (j = 0; j < queue.count; j++)
+        queue.units[j].filename = argv[i + j];
+
+    // A single job writes straight to stdout and stderr, in order.
+    if (jobs == 1 || queue.count == 1) {
+        for (j = 0; j < queue.count; j++)
+            queue.units[j].exit_code = compile_file(queue.units[j].filename,
+                    &queue.options);
+
+        ast_walk_free_stack();
+    } else
+        compile_files(&queue, jobs < queue.count ? jobs : queue.count);
+
+    // The exit code of a file tells how far it got; report the worst one, and
+    // name the files that failed when there are several.
+    for (j = 0; j < queue.count; j++) {
+        unit *u = queue.units + j;
+
+        if (u->exit_code > exit_code)
+            exit_code = u->exit_code;
+
+        if (u->exit_code && queue.count > 1)
+            fprintf(stderr, "%s: exit code %d\n", u->filename, u->exit_code);
+    }
+
+    if (queue.options.cache) {
+        if (stats_enabled())
+            cache_print_stats(queue.options.cache, stderr, stats_json());
+
+        cache_close(queue.options.cache);
+    }
+
+    free(queue.units);
 
     return exit_code;
 }
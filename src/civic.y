@@ -5,13 +5,50 @@
 #include "ast_printer.h"
 #include <string.h>
 
-extern FILE *yyin;
-extern char *yytext;
+extern char *yyget_text(void *scanner);
+
+// Parser traces (-b) go to the diagnostics of the compilation unit.
+#define YYFPRINTF(stream, ...) fprintf(ast_stderr(), __VA_ARGS__)
 
 #define APPEND(parent, child) (ast_node_append(parent, child))
 #define MARK(node, flag) (ast_flag_set(node, NODE_FLAG_##flag))
 #define TYPE(node, type) (ast_flag_set(node, type))
-#define NEW(type, data) (ast_new_node(NODE_##type, data))
+// Nodes start at the first token of the rule that makes them. yyloc is the
+// location of that rule, which bison computes before running the action.
+#define NEW(type, data) (ast_node_at(ast_new_node(NODE_##type, data), \
+            yyloc.offset))
+
+static inline ast_node *ast_node_at(ast_node *node, unsigned int offset)
+{
+    if (node)
+        node->offset = offset;
+
+    return node;
+}
+
+// The default location of a rule, extended with the offset and length. An
+// empty rule is located at the end of the symbol before it.
+#define YYLLOC_DEFAULT(Current, Rhs, N) \
+    do { \
+        if (N) { \
+            (Current).first_line = YYRHSLOC(Rhs, 1).first_line; \
+            (Current).first_column = YYRHSLOC(Rhs, 1).first_column; \
+            (Current).last_line = YYRHSLOC(Rhs, N).last_line; \
+            (Current).last_column = YYRHSLOC(Rhs, N).last_column; \
+            (Current).offset = YYRHSLOC(Rhs, 1).offset; \
+            (Current).length = YYRHSLOC(Rhs, N).offset \
+                + YYRHSLOC(Rhs, N).length - YYRHSLOC(Rhs, 1).offset; \
+        } else { \
+            (Current).first_line = (Current).last_line = \
+                YYRHSLOC(Rhs, 0).last_line; \
+            (Current).first_column = (Current).last_column = \
+                YYRHSLOC(Rhs, 0).last_column; \
+            (Current).offset = YYRHSLOC(Rhs, 0).offset \
+                + YYRHSLOC(Rhs, 0).length; \
+            (Current).length = 0; \
+        } \
+        (Current).filename = YYRHSLOC(Rhs, N ? 1 : 0).filename; \
+    } while (0)
 
 #define STR(data) ((ast_data_type){.sval = data})
 #define INT(data) ((ast_data_type){.ival = data})
@@ -69,20 +106,29 @@ typedef struct YYLTYPE
   int first_column;
   int last_line;
   int last_column;
+  unsigned int offset;
+  unsigned int length;
   char *filename;
 } YYLTYPE;
 
-void yyerror(ast_node *root, const char *msg);
-int yylex();
+#include "parser.h"
+}
+
+%code provides {
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+void yyerror(YYLTYPE *lloc, void *scanner, parse_context *ctx,
+        const char *msg);
 }
 
-%parse-param {ast_node *root}
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner} {parse_context *ctx}
 %error-verbose
 %locations
 
 %union {
     ast_node *node;
-    char *str;
+    symbol str;
     unsigned int i;
     double d;
 }
@@ -124,7 +170,7 @@ program : decls ;
 
 decls : /* empty */
       | decls decl
-        { APPEND(root, $2); }
+        { APPEND(ctx->root, $2); }
       ;
 
 decl : func_dec
@@ -272,8 +318,9 @@ expr_list : /* empty */ { $$ = NEW(BLOCK, NODE(NULL)); }
 
 %%
 
-void yyerror(ast_node *root, const char *msg) {
-    fprintf(stderr, "%d:%d-%d: %s before \"%s\"\n", yylloc.first_line,
-            yylloc.first_column, yylloc.last_column, msg, yytext);
-    (void) root;
+void yyerror(YYLTYPE *lloc, void *scanner, parse_context *ctx,
+        const char *msg) {
+    fprintf(ast_stderr(), "%d:%d-%d: %s before \"%s\"\n", lloc->first_line,
+            lloc->first_column, lloc->last_column, msg, yyget_text(scanner));
+    ctx->errors++;
 }
@@ -0,0 +1,147 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "diagnostics.h"
+
+#define DIAG_BUFFER_SIZE 4096
+
+// The diagnostics of the compilation unit on this thread, if any. Without
+// one, messages are written to the unit's stderr right away.
+static __thread diagnostics *diag = NULL;
+
+void diag_init(diagnostics *d, const char *filename, unsigned int max_errors)
+{
+    *d = (diagnostics){.filename = filename, .max_errors = max_errors};
+}
+
+void diag_free(diagnostics *d)
+{
+    free(d->lines);
+    free(d->buf);
+    *d = (diagnostics){0};
+}
+
+void diag_use(diagnostics *d)
+{
+    diag = d;
+}
+
+diagnostics *diag_current()
+{
+    return diag;
+}
+
+// Take over the line index of the source, as recorded by the scanner.
+void diag_set_lines(diagnostics *d, uint32_t *lines, size_t count)
+{
+    free(d->lines);
+    d->lines = lines;
+    d->line_count = count;
+}
+
+// Resolve an offset to a line and column, both counted from one, with a
+// binary search over the line starts.
+void diag_location(diagnostics *d, uint32_t offset, unsigned int *line,
+        unsigned int *column)
+{
+    size_t lo = 0, hi = d->line_count;
+
+    // Find the number of lines after the first that start at or before the
+    // offset.
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (d->lines[mid] <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *line = lo + 1;
+    *column = offset - (lo ? d->lines[lo - 1] : 0) + 1;
+}
+
+static void diag_vprintf(diagnostics *d, const char *fmt, va_list args)
+{
+    va_list again;
+    int n;
+
+    if (!d) {
+        vfprintf(ast_stderr(), fmt, args);
+        return;
+    }
+
+    // Format into the free space of the buffer, and once more after growing
+    // it when the message did not fit.
+    va_copy(again, args);
+    n = vsnprintf(d->size ? d->buf + d->len : NULL, d->size - d->len, fmt,
+            args);
+
+    if (n >= 0 && d->len + n >= d->size) {
+        size_t size = d->size ? d->size : DIAG_BUFFER_SIZE;
+        char *buf;
+
+        while (d->len + n >= size)
+            size *= 2;
+
+        if ((buf = realloc(d->buf, size))) {
+            d->buf = buf;
+            d->size = size;
+            n = vsnprintf(d->buf + d->len, d->size - d->len, fmt, again);
+        } else
+            n = -1;
+    }
+
+    va_end(again);
+
+    if (n > 0)
+        d->len += n;
+}
+
+void diag_printf(diagnostics *d, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    diag_vprintf(d, fmt, args);
+    va_end(args);
+}
+
+// Start an error at an offset in the source. Returns zero when the error is
+// over the limit; the caller then skips formatting its message.
+int diag_error(diagnostics *d, uint32_t offset)
+{
+    unsigned int line, column;
+
+    if (d && d->max_errors && d->errors++ >= d->max_errors)
+        return 0;
+
+    if (d && d->filename) {
+        if (offset != AST_OFFSET_NONE) {
+            diag_location(d, offset, &line, &column);
+            diag_printf(d, "%s:%u:%u: ", d->filename, line, column);
+        } else
+            diag_printf(d, "%s: ", d->filename);
+    }
+
+    diag_printf(d, "\x1b[1;31merror:\x1b[0m ");
+
+    return 1;
+}
+
+// Write the buffered messages and clear the buffer.
+void diag_flush(diagnostics *d, FILE *out)
+{
+    if (d->len)
+        fwrite(d->buf, 1, d->len, out);
+
+    if (d->max_errors && d->errors > d->max_errors)
+        fprintf(out, "%s: %u more errors not reported.\n",
+                d->filename ? d->filename : "-",
+                d->errors - d->max_errors);
+
+    d->len = 0;
+    d->errors = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef GUARD_DIAGNOSTICS__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DIAG_MAX_ERRORS 100
+
+// The messages of one compilation unit. They are collected in one buffer and
+// written at once by diag_flush(). Messages refer to a byte offset in the
+// source, which is resolved to a line and column only for the messages that
+// are reported. Errors after the first max_errors are counted, but not
+// formatted.
+typedef struct {
+    const char *filename;
+
+    // Offsets of the starts of the lines after the first, in order.
+    uint32_t *lines;
+    size_t line_count;
+
+    char *buf;
+    size_t len;
+    size_t size;
+
+    unsigned int errors;
+    unsigned int max_errors;
+} diagnostics;
+
+void diag_init(diagnostics *d, const char *filename, unsigned int max_errors);
+void diag_free(diagnostics *d);
+void diag_use(diagnostics *d);
+diagnostics *diag_current();
+void diag_set_lines(diagnostics *d, uint32_t *lines, size_t count);
+void diag_location(diagnostics *d, uint32_t offset, unsigned int *line,
+        unsigned int *column);
+int diag_error(diagnostics *d, uint32_t offset);
+void diag_printf(diagnostics *d, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void diag_flush(diagnostics *d, FILE *out);
+
+#define GUARD_DIAGNOSTICS__
+#endif
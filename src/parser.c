@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <string.h>
+
+#include "parser.h"
+#include "civic_parser.h"
+
+extern int yylex_init_extra(parse_context *ctx, void **scanner);
+extern int yylex_destroy(void *scanner);
+extern void yyset_in(FILE *in, void *scanner);
+extern void lexer_scan_source(source_file *source, void *scanner);
+
+static parse_context *parse_context_init(parse_context *ctx)
+{
+    if (yylex_init_extra(ctx, &ctx->scanner)) {
+        free(ctx);
+        return NULL;
+    }
+
+    if (ctx->source)
+        lexer_scan_source(ctx->source, ctx->scanner);
+    else
+        yyset_in(ctx->stream, ctx->scanner);
+
+    return ctx;
+}
+
+// Open a file for parsing. Regular files are mapped and scanned in place;
+// stdin ("-") and anything else that cannot be mapped is streamed.
+parse_context *parse_context_new(const char *filename)
+{
+    parse_context *ctx = calloc(1, sizeof(parse_context));
+
+    if (!ctx)
+        return NULL;
+
+    ctx->filename = filename;
+    ctx->owns_input = 1;
+
+    if (strncmp(filename, "-", 2) == 0) {
+        ctx->stream = stdin;
+        ctx->owns_input = 0;
+    } else if (!(ctx->source = source_map(filename)) &&
+            !(ctx->stream = fopen(filename, "r"))) {
+        fprintf(ast_stderr(), "%s: %s\n", filename, strerror(errno));
+        free(ctx);
+        return NULL;
+    }
+
+    return parse_context_init(ctx);
+}
+
+// Parse an already mapped file. The mapping is not owned by the context.
+parse_context *parse_context_new_source(source_file *source)
+{
+    parse_context *ctx = calloc(1, sizeof(parse_context));
+
+    if (!ctx)
+        return NULL;
+
+    ctx->source = source;
+
+    return parse_context_init(ctx);
+}
+
+// Parse an open stream. The stream is not owned by the context.
+parse_context *parse_context_new_stream(FILE *stream)
+{
+    parse_context *ctx = calloc(1, sizeof(parse_context));
+
+    if (!ctx)
+        return NULL;
+
+    ctx->stream = stream;
+
+    return parse_context_init(ctx);
+}
+
+// Free the scanner and the input. The tree is not freed; it lives in the
+// arena of the compilation unit.
+void parse_context_free(parse_context *ctx)
+{
+    if (!ctx)
+        return;
+
+    yylex_destroy(ctx->scanner);
+
+    // The tree holds no pointers into the source, as identifiers are
+    // interned.
+    if (ctx->owns_input) {
+        source_unmap(ctx->source);
+
+        if (ctx->stream)
+            fclose(ctx->stream);
+    }
+
+    free(ctx->lines);
+    free(ctx);
+}
+
+// Record that a line starts at the current offset.
+void parse_context_newline(parse_context *ctx)
+{
+    if (ctx->line_count == ctx->line_size) {
+        size_t size = ctx->line_size ? 2 * ctx->line_size : 256;
+        uint32_t *lines = realloc(ctx->lines, size * sizeof(uint32_t));
+
+        // Without the index, diagnostics point at wrong lines, which is not
+        // worth failing the parse over.
+        if (!lines)
+            return;
+
+        ctx->lines = lines;
+        ctx->line_size = size;
+    }
+
+    ctx->lines[ctx->line_count++] = ctx->offset;
+}
+
+// Parse the input into a new tree. Returns NULL on a syntax error.
+ast_node *parse_context_run(parse_context *ctx)
+{
+    ctx->root = ast_new_node(NODE_BLOCK, (ast_data_type){.sval = NULL});
+
+    if (yyparse(ctx->scanner, ctx) || ctx->errors)
+        return NULL;
+
+    return ctx->root;
+}
+
+// Scan the input without parsing it. Returns the number of tokens.
+size_t parse_context_lex(parse_context *ctx)
+{
+    YYSTYPE value;
+    YYLTYPE location;
+    size_t tokens = 0;
+
+    while (yylex(&value, &location, ctx->scanner))
+        tokens++;
+
+    return tokens;
+}
@@ -0,0 +1,44 @@
+#ifndef GUARD_PARSER__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ast.h"
+#include "source.h"
+
+// State of one parse: the input, the scanner and its location state, the tree
+// that is built and the errors found. Nothing is shared between contexts, so
+// files can be parsed concurrently, each with its own context.
+typedef struct {
+    const char *filename;
+
+    // The input is either a mapped file that is scanned in place, or a stream.
+    source_file *source;
+    FILE *stream;
+    int owns_input;
+
+    void *scanner;
+    unsigned int column;
+    unsigned int offset;
+
+    // Offsets of the starts of the lines after the first, recorded by the
+    // scanner for resolving the offsets of nodes in diagnostics.
+    uint32_t *lines;
+    size_t line_count;
+    size_t line_size;
+
+    ast_node *root;
+    unsigned int errors;
+} parse_context;
+
+parse_context *parse_context_new(const char *filename);
+parse_context *parse_context_new_source(source_file *source);
+parse_context *parse_context_new_stream(FILE *stream);
+void parse_context_free(parse_context *ctx);
+void parse_context_newline(parse_context *ctx);
+
+ast_node *parse_context_run(parse_context *ctx);
+size_t parse_context_lex(parse_context *ctx);
+
+#define GUARD_PARSER__
+#endif
@@ -0,0 +1,95 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ast.h"
+#include "ast_visitor.h"
+#include "phases.h"
+#include "stats.h"
+
+// Number of full tree walks done by passes in this thread.
+static __thread size_t walks = 0;
+
+size_t pass_manager_walks()
+{
+    return walks;
+}
+
+void pass_manager_reset_walks()
+{
+    walks = 0;
+}
+
+static int pass_fusable(const pass_info *pass, unsigned int kinds)
+{
+    return pass->visitor && !(pass->flags & PASS_BARRIER)
+        && !(pass->kinds & kinds);
+}
+
+// Merge the callbacks of a pass into the visitor of its fused group.
+static void pass_merge(ast_visitor *fused, const pass_info *pass)
+{
+    int i;
+
+    for (i = 0; i < AST_NODE_TYPES; i++) {
+        if (!(pass->kinds & (1u << i))) {
+            assert(!pass->visitor->pre[i] && !pass->visitor->post[i]);
+            continue;
+        }
+
+        fused->pre[i] = pass->visitor->pre[i];
+        fused->post[i] = pass->visitor->post[i];
+    }
+}
+
+unsigned int pass_manager_run(const char *phase, const pass_info *passes,
+        size_t count, ast_node *root)
+{
+    unsigned int error = 0;
+    size_t i = 0;
+    stats_record *record = NULL;
+    char name[STATS_NAME_SIZE];
+
+    while (i < count) {
+        if (!passes[i].visitor) {
+            if (stats_enabled())
+                record = stats_begin(phase, passes[i].name, root);
+
+            error |= passes[i].run(root);
+            walks++;
+            i++;
+
+            if (record)
+                stats_end(record, root);
+
+            continue;
+        }
+
+        // Collect the following local rewrites that act on other node kinds
+        // into a single visitor.
+        ast_visitor fused = {{0}, {0}};
+        unsigned int kinds = passes[i].kinds;
+
+        snprintf(name, sizeof(name), "%s", passes[i].name);
+        pass_merge(&fused, passes + i++);
+
+        while (i < count && pass_fusable(passes + i, kinds)) {
+            size_t len = strlen(name);
+
+            snprintf(name + len, sizeof(name) - len, "+%s", passes[i].name);
+            kinds |= passes[i].kinds;
+            pass_merge(&fused, passes + i++);
+        }
+
+        if (stats_enabled())
+            record = stats_begin(phase, name, root);
+
+        error |= ast_walk(root, &fused, NULL);
+        walks++;
+
+        if (record)
+            stats_end(record, root);
+    }
+
+    return error;
+}
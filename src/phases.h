@@ -1,9 +1,36 @@
 #ifndef GUARD_PHASES__
 
 #include "ast.h"
+#include "ast_visitor.h"
 
 typedef unsigned int (*pass_fn)(ast_node *root);
 
+#define AST_KIND(type) (1u << ((type) >> AST_NODE_TYPE_SHIFT))
+
+// The pass must not be fused with the passes before it, e.g. because it
+// depends on their result for the whole tree.
+#define PASS_BARRIER 1
+
+// A pass either walks the tree on its own (run), or is a local rewrite with a
+// stateless visitor. Consecutive local rewrites that act on disjoint node
+// kinds are fused by the pass manager into a single walk.
+typedef struct {
+    const char *name;
+    pass_fn run;
+    const ast_visitor *visitor;
+    unsigned int kinds;
+    unsigned int flags;
+} pass_info;
+
+#define PASS(name) { #name, &pass_##name, NULL, 0, PASS_BARRIER }
+#define LOCAL_PASS(name, kinds, flags) \
+    { #name, &pass_##name, &name##_visitor, (kinds), (flags) }
+
+unsigned int pass_manager_run(const char *phase, const pass_info *passes,
+        size_t count, ast_node *root);
+size_t pass_manager_walks();
+void pass_manager_reset_walks();
+
 // Preprocessor phase
 //unsigned int pass_prune_empty_nodes(ast_node *root);
 unsigned int pass_split_var_init(ast_node *root);
@@ -12,22 +39,55 @@ unsigned int pass_split_var_init(ast_node *root);
 unsigned int pass_context_analysis(ast_node *root);
 
 // Loops phase
+#define UNROLL_LIMIT 128
+#define UNROLL_FACTOR 4
+
+void loops_set_unroll(unsigned int limit, unsigned int factor);
+unsigned int pass_unroll_loops(ast_node *root);
+extern const ast_visitor while_to_do_visitor;
+extern const ast_visitor for_to_do_visitor;
 unsigned int pass_while_to_do(ast_node *root);
 unsigned int pass_for_to_do(ast_node *root);
 
+// Optimize phase
+#define INLINE_LIMIT 32
+#define INLINE_DEPTH 3
+
+void optimize_set_inline(unsigned int limit, unsigned int depth);
+unsigned int pass_inline_functions(ast_node *root);
+extern const ast_visitor fold_constants_visitor;
+unsigned int pass_fold_constants(ast_node *root);
+unsigned int pass_propagate_constants(ast_node *root);
+unsigned int pass_reduce_strength(ast_node *root);
+unsigned int pass_eliminate_dead_code(ast_node *root);
+unsigned int pass_hoist_invariants(ast_node *root);
+unsigned int pass_eliminate_common_subexprs(ast_node *root);
+
 #define COMPILER_PHASES \
-pass_fn preprocess_passes[] = { \
-    /*&pass_prune_empty_nodes,*/ \
-    &pass_split_var_init, \
+pass_info preprocess_passes[] = { \
+    /*PASS(prune_empty_nodes),*/ \
+    PASS(split_var_init), \
+}; \
+ \
+pass_info analyse_passes[] = { \
+    PASS(context_analysis), \
 }; \
  \
-pass_fn analyse_passes[] = { \
-    &pass_context_analysis, \
+pass_info loops_passes[] = { \
+    PASS(unroll_loops), \
+    LOCAL_PASS(for_to_do, AST_KIND(NODE_FOR), 0), \
+    LOCAL_PASS(while_to_do, AST_KIND(NODE_WHILE), 0), \
 }; \
  \
-pass_fn loops_passes[] = { \
-    &pass_for_to_do, \
-    &pass_while_to_do, \
+pass_info optimize_passes[] = { \
+    PASS(inline_functions), \
+    LOCAL_PASS(fold_constants, AST_KIND(NODE_UNARY_OP) \
+            | AST_KIND(NODE_BIN_OP) | AST_KIND(NODE_CAST), 0), \
+    PASS(propagate_constants), \
+    PASS(reduce_strength), \
+    PASS(eliminate_dead_code), \
+    PASS(hoist_invariants), \
+    PASS(eliminate_common_subexprs), \
 }; \
 
 #define GUARD_PHASES__
@@ -4,193 +4,312 @@
 
 #include "phases.h"
 #include "ast.h"
+#include "ast_frozen.h"
 #include "ast_helpers.h"
 #include "ast_printer.h"
+#include "scope.h"
+
+// The analysis only reads the structure of the tree, so it runs over a frozen
+// copy of it; the types and declarations it finds are stored on the nodes of
+// the tree itself. The scan keeps the function bodies around the current
+// node, innermost last, so the enclosing function is known without walking
+// up the tree.
+typedef struct {
+    const ast_frozen *tree;
+    scope_table *scope;
+
+    ast_index *bodies;
+    unsigned int depth;
+    unsigned int size;
+
+    // Per node, the inferred type of an expression and the declaration of an
+    // identifier, call or assignment. Zero is not typed yet; typed nodes
+    // have TYPED set, next to their data type or zero after an error.
+    uint8_t *types;
+    ast_index *decls;
+} analysis;
+
+#define TYPED 0x80
+
+#define TYPE_OF(a, node) \
+    ((ast_data_type_flag) (((a)->types[node] & ~TYPED) << AST_DATA_TYPE_SHIFT))
+
+// Function head to name in an error about a node: the function a declaration
+// belongs to, or a function itself, or else the function being scanned.
+static ast_node *error_scope(analysis *a, ast_index node)
+{
+    const ast_frozen *tree = a->tree;
+    ast_index parent;
 
-#define SCOPE_LEVEL_LIMIT 42
+    switch (AST_FROZEN_NODE_TYPE(tree, node)) {
+    case NODE_FN_HEAD:
+        return tree->nodes[node];
+    case NODE_PARAM:
+    case NODE_VAR_DEC:
+        // Parameters and local variables sit in a block of the head or body
+        // of their function; globals sit in the root.
+        parent = tree->links[tree->links[node].parent].parent;
 
-static ast_node *scope_contains_ident(node_stack *scope, ast_node *node)
-{
-    size_t i;
+        if (parent == AST_INDEX_NONE)
+            return NULL;
 
-    assert(scope);
+        if (AST_FROZEN_NODE_TYPE(tree, parent) == NODE_FN_BODY)
+            parent = tree->links[parent].parent;
 
-    for (i = scope->items; i > 0; i--)
-        if (strcmp(scope->data[i - 1]->data.sval, node->data.sval) == 0)
-            return scope->data[i - 1];
+        return tree->nodes[parent];
+    default:
+        break;
+    }
 
-    ast_error("missing definition of identifier: `%s'", node);
+    if (!a->depth)
+        return NULL;
 
-    return NULL;
+    return tree->nodes[tree->links[a->bodies[a->depth - 1]].parent];
 }
 
-static unsigned int scope_level(ast_node *node)
+static ast_index scope_contains_ident(analysis *a, ast_index node)
 {
-    size_t i = 0;
+    ast_index def_node;
 
-    if (!node)
-        return 0;
-
-    // The return value of a function is sometimes not contained in a
-    // NODE_BLOCK node. Therefore, check if the function has a return value and
-    // that the current node is the return node.
-    if (AST_NODE_TYPE(node->parent) == NODE_FN_BODY &&
-            node->parent->nary == 4 && node->parent->children[3] == node)
-        i++;
+    assert(a->scope);
 
-    for (; node->parent; node = node->parent)
-        if (AST_NODE_TYPE(node) == NODE_BLOCK)
-            i++;
+    if ((def_node = scope_lookup(a->scope, a->tree->data[node].sval))
+            != AST_INDEX_NONE)
+        return def_node;
 
-    assert(i < SCOPE_LEVEL_LIMIT);
+    ast_error("missing definition of identifier: `%s'", a->tree->nodes[node],
+            error_scope(a, node));
 
-    return i;
+    return AST_INDEX_NONE;
 }
 
-static node_stack *get_scope(node_stack **scopes, ast_node *node)
+static unsigned int add_scope_node(analysis *a, ast_index node)
 {
-    unsigned int scope;
+    const ast_frozen *tree = a->tree;
+    unsigned int error = 0;
+    ast_index c;
 
-    scope = scope_level(node);
+    AST_FROZEN_FOREACH_CHILD(tree, node, c) {
+        assert(AST_FROZEN_NODE_TYPE(tree, c) == NODE_PARAM
+                || AST_FROZEN_NODE_TYPE(tree, c) == NODE_VAR_DEC
+                || AST_FROZEN_NODE_TYPE(tree, c) == NODE_FN_HEAD);
 
-    // Find the last defined scope
-    while (scope && !scopes[scope])
-        scope--;
+        if (scope_declare(a->scope, tree->data[c].sval, c) != AST_INDEX_NONE) {
+            ast_error("redeclaration of variable `%s' in same scope",
+                    tree->nodes[c], error_scope(a, c));
+            error = 1;
+        }
+    }
 
-    return scopes[scope];
+    return error;
 }
 
-static unsigned int detect_duplicated_var(ast_node **stack_data, size_t
-        stack_size, ast_node *node)
+static int is_numeric(ast_data_type_flag type)
 {
-    size_t i;
-
-    if (!stack_data || !node)
-        return 0;
-
-    for (i = 0; i < stack_size; i++)
-        if (strcmp(stack_data[i]->data.sval, node->data.sval) == 0)
-            return 1;
+    return type == NODE_FLAG_INT || type == NODE_FLAG_FLOAT;
+}
 
-    return 0;
+static int is_logical(int op)
+{
+    return op == OP_AND || op == OP_OR || op == OP_LAND || op == OP_LOR;
 }
 
-static unsigned int add_scope_node(node_stack **scopes, size_t scope, ast_node
-        *node)
+// Infer the type of one node of an expression, of which the operands have
+// been typed already. Identifiers and calls are resolved to their
+// declaration. Returns zero after an error, also when an operand had one.
+static ast_data_type_flag type_node(analysis *a, ast_index node)
 {
-    size_t i;
-    unsigned int error = 0;
+    const ast_frozen *tree = a->tree;
+    ast_data_type_flag l, r;
+    const char *expected;
+    int op, valid;
+    ast_index def_node;
 
-    node_stack *prev_scope;
-    size_t prev_items;
-    size_t new_items;
+    switch (AST_FROZEN_NODE_TYPE(tree, node)) {
+    case NODE_CONST:
+        if (AST_FROZEN_DATA_TYPE(tree, node) != NODE_FLAG_IDENT)
+            return AST_FROZEN_DATA_TYPE(tree, node);
 
-    if (!scopes || !node)
-        return 1;
+        if ((def_node = scope_contains_ident(a, node)) == AST_INDEX_NONE)
+            return 0;
 
-    prev_scope = scopes[scope - 1];
-    prev_items = prev_scope->items;
-    new_items = scopes[scope]->items - prev_items;
+        a->decls[node] = def_node;
 
-    for (i = 0; i < node->nary; i++) {
-        assert(AST_NODE_TYPE(node->children[i]) == NODE_PARAM
-                || AST_NODE_TYPE(node->children[i]) == NODE_VAR_DEC
-                || AST_NODE_TYPE(node->children[i]) == NODE_FN_HEAD);
+        return AST_FROZEN_DATA_TYPE(tree, def_node);
+    case NODE_CALL:
+        if ((def_node = scope_contains_ident(a, node)) == AST_INDEX_NONE)
+            return 0;
 
-        if (!detect_duplicated_var(scopes[scope]->data + prev_items,
-                    new_items, node->children[i])) {
-            node_stack_push(scopes[scope], node->children[i]);
-            new_items++;
-            assert(scopes[scope]->items == new_items + prev_items);
-        }
-        else {
-            ast_error("redeclaration of variable `%s' in same scope",
-                        node->children[i]);
-            error = 1;
-        }
-    }
+        a->decls[node] = def_node;
 
-    return error;
-}
+        if (AST_FROZEN_NODE_TYPE(tree, def_node) != NODE_FN_HEAD) {
+            ast_error("invalid callee: cannot call variable `%s' as a "
+                      "function", tree->nodes[def_node],
+                      error_scope(a, def_node));
+            return 0;
+        }
 
-static ast_data_type_flag node_type_inference(node_stack *scope, ast_node
-        *node)
-{
-    (void) scope;
+        return AST_FROZEN_DATA_TYPE(tree, def_node);
+    case NODE_CAST:
+        if (!(l = TYPE_OF(a, node + 1)))
+            return 0;
 
-    ast_data_type_flag a, b;
+        if (l == NODE_FLAG_VOID) {
+            ast_error("invalid cast: `%s' cannot cast an expression of type"
+                      " `void'", tree->nodes[node], error_scope(a, node));
+            return 0;
+        }
 
-    switch (AST_NODE_TYPE(node)) {
-    case NODE_CONST:
-        if (AST_DATA_TYPE(node) != NODE_FLAG_IDENT)
-            return AST_DATA_TYPE(node);
+        return tree->data[node].ival;
+    case NODE_UNARY_OP:
+        if (!(l = TYPE_OF(a, node + 1)))
+            return 0;
 
-        ast_node *def_node;
+        if (tree->data[node].ival == OP_NOT ? l != NODE_FLAG_BOOL
+                : !is_numeric(l)) {
+            char msg[AST_ERROR_SIZE];
+            snprintf(msg, sizeof(msg),
+                    "operand type mismatch: `%%s' requires %s type"
+                    " but `%s' was given", tree->data[node].ival == OP_NOT
+                    ? "a bool" : "a float or int",
+                    ast_data_type_name(l));
+            ast_error(msg, tree->nodes[node], error_scope(a, node));
 
-        if (!(def_node = scope_contains_ident(scope, node)))
             return 0;
+        }
 
-        return AST_DATA_TYPE(def_node);
+        return l;
     case NODE_BIN_OP:
-        a = node_type_inference(scope, node->children[0]);
-        b = node_type_inference(scope, node->children[1]);
+        l = TYPE_OF(a, node + 1);
+        r = TYPE_OF(a, tree->links[node + 1].end);
 
-        if (!a || !b)
+        if (!l || !r)
             return 0;
 
-        if ((a != NODE_FLAG_INT && a != NODE_FLAG_FLOAT)
-                || (b != NODE_FLAG_INT && b != NODE_FLAG_FLOAT)) {
-            char *msg = malloc(256 * sizeof(char));
-            snprintf(msg, 256, "operand type mismatch: `%%s' requires float"
-                     " or int types but `%s' and `%s' were given",
-                     ast_data_type_name(a), ast_data_type_name(b));
-            ast_error(msg, node);
-            free(msg);
+        op = tree->data[node].ival;
+
+        // Equality compares two bools or two numbers, the logical operators
+        // take bools and the other operators take numbers.
+        if (op == OP_EQ || op == OP_NE) {
+            expected = "bool, float or int";
+            valid = (l == NODE_FLAG_BOOL || is_numeric(l))
+                && (r == NODE_FLAG_BOOL || is_numeric(r));
+        } else if (is_logical(op)) {
+            expected = "bool";
+            valid = l == NODE_FLAG_BOOL && r == NODE_FLAG_BOOL;
+        } else {
+            expected = "float or int";
+            valid = is_numeric(l) && is_numeric(r);
+        }
+
+        if (!valid) {
+            char msg[AST_ERROR_SIZE];
+            snprintf(msg, sizeof(msg),
+                    "operand type mismatch: `%%s' requires %s types but"
+                    " `%s' and `%s' were given", expected,
+                    ast_data_type_name(l), ast_data_type_name(r));
+            ast_error(msg, tree->nodes[node], error_scope(a, node));
 
             return 0;
         }
 
         // Implicit casting from int to float is not supported by CiviC.
-        if (a != b) {
-            char *msg = malloc(256 * sizeof(char));
-            snprintf(msg, 256, "operand type mismatch: `%%s' requires "
-                     " two similar types but `%s' and `%s' were given",
-                     ast_data_type_name(a), ast_data_type_name(b));
-            ast_error(msg, node);
-            free(msg);
+        if (l != r) {
+            char msg[AST_ERROR_SIZE];
+            snprintf(msg, sizeof(msg),
+                    "operand type mismatch: `%%s' requires "
+                    " two similar types but `%s' and `%s' were given",
+                    ast_data_type_name(l), ast_data_type_name(r));
+            ast_error(msg, tree->nodes[node], error_scope(a, node));
 
             return 0;
         }
 
-        return a;
+        // Comparisons and logical operators are bool, arithmetic keeps the
+        // type of its operands.
+        switch (op) {
+        case OP_LE: case OP_LT: case OP_GE: case OP_GT: case OP_EQ: case OP_NE:
+        case OP_AND: case OP_OR: case OP_LAND: case OP_LOR:
+            return NODE_FLAG_BOOL;
+        default:
+            return l;
+        }
     default:
-        ast_error("type inference got an unknown node type: `%s'", node);
+        ast_error("type inference got an unknown node type: `%s'",
+                tree->nodes[node], error_scope(a, node));
     }
 
     return 0;
 }
 
-static unsigned int type_check_return_node(node_stack *scope, ast_node *node)
+static int is_expression(const ast_frozen *tree, ast_index node)
+{
+    switch (AST_FROZEN_NODE_TYPE(tree, node)) {
+    case NODE_CALL:
+    case NODE_UNARY_OP:
+    case NODE_BIN_OP:
+    case NODE_CAST:
+    case NODE_CONST:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// The type of an expression. The first time an expression is asked for, it
+// and all of its operands are typed bottom-up: in pre-order the operands
+// come after their operator, so a backward scan over the subtree types every
+// node after its operands. The type and declaration are stored on the nodes
+// as well, for the passes after the analysis.
+static ast_data_type_flag expr_type(analysis *a, ast_index node)
+{
+    const ast_frozen *tree = a->tree;
+    ast_index i;
+
+    if (!a->types[node]) {
+        for (i = tree->links[node].end; i-- > node;) {
+            if (a->types[i] || !is_expression(tree, i))
+                continue;
+
+            ast_data_type_flag type = type_node(a, i);
+            ast_node *n = tree->nodes[i];
+
+            a->types[i] = TYPED | type >> AST_DATA_TYPE_SHIFT;
+            AST_EXPR_TYPE_SET(n, type);
+
+            if (a->decls[i] != AST_INDEX_NONE)
+                n->decl = tree->nodes[a->decls[i]];
+        }
+    }
+
+    return TYPE_OF(a, node);
+}
+
+static unsigned int type_check_return_node(analysis *a, ast_index node)
 {
-    assert(AST_NODE_TYPE(node) == NODE_FN_BODY);
-    assert(node->parent && AST_NODE_TYPE(node->parent) == NODE_FN_HEAD);
+    const ast_frozen *tree = a->tree;
+    ast_index head = tree->links[node].parent;
+
+    assert(AST_FROZEN_NODE_TYPE(tree, node) == NODE_FN_BODY);
+    assert(head != AST_INDEX_NONE
+            && AST_FROZEN_NODE_TYPE(tree, head) == NODE_FN_HEAD);
 
-    if (node->nary != 4)
+    if (tree->links[node].nary != 4)
         return 0;
 
-    ast_data_type_flag def_type = AST_DATA_TYPE(node->parent);
-    ast_data_type_flag node_type = node_type_inference(scope,
-            node->children[3]);
+    ast_data_type_flag def_type = AST_FROZEN_DATA_TYPE(tree, head);
+    ast_data_type_flag node_type = expr_type(a,
+            ast_frozen_child(tree, node, 3));
 
     if (!def_type || !node_type)
         return 1;
 
     if (def_type != node_type) {
-        char *msg = malloc(256 * sizeof(char));
-        snprintf(msg, 256, "data type mismatch: `%%s' cannot return the"
-                 " expression of type `%s'", ast_data_type_name(node_type));
-        ast_error(msg, node->parent);
-        free(msg);
+        char msg[AST_ERROR_SIZE];
+        snprintf(msg, sizeof(msg),
+                "data type mismatch: `%%s' cannot return the"
+                " expression of type `%s'", ast_data_type_name(node_type));
+        ast_error(msg, tree->nodes[head], error_scope(a, head));
 
         return 1;
     }
@@ -198,184 +317,276 @@ static unsigned int type_check_return_node(node_stack *scope, ast_node *node)
     return 0;
 }
 
-static unsigned int type_check_assign_node(node_stack *scope, ast_node *node,
-        ast_node *def_node)
+static unsigned int type_check_assign_node(analysis *a, ast_index node,
+        ast_index def_node)
 {
-    if (AST_NODE_TYPE(def_node) == NODE_FN_HEAD) {
+    const ast_frozen *tree = a->tree;
+
+    if (AST_FROZEN_NODE_TYPE(tree, def_node) == NODE_FN_HEAD) {
         ast_error("invalid assignment: cannot assign expression to function"
-                  "`%s'", def_node);
+                  "`%s'", tree->nodes[def_node], error_scope(a, def_node));
         return 1;
     }
 
-    assert(AST_NODE_TYPE(def_node) == NODE_VAR_DEC);
-    assert(AST_NODE_TYPE(node) == NODE_ASSIGN);
+    assert(AST_FROZEN_NODE_TYPE(tree, def_node) == NODE_VAR_DEC
+            || AST_FROZEN_NODE_TYPE(tree, def_node) == NODE_PARAM);
+    assert(AST_FROZEN_NODE_TYPE(tree, node) == NODE_ASSIGN);
 
-    ast_data_type_flag def_type = AST_DATA_TYPE(def_node);
-    ast_data_type_flag node_type = node_type_inference(scope,
-            node->children[0]);
+    ast_data_type_flag def_type = AST_FROZEN_DATA_TYPE(tree, def_node);
+    ast_data_type_flag node_type = expr_type(a, node + 1);
 
     if (!def_type || !node_type)
         return 1;
 
     if (def_type != node_type) {
-        char *msg = malloc(256 * sizeof(char));
-        snprintf(msg, 256, "data type mismatch: `%s %%s' cannot assign the"
-                 " expression of type `%s'", ast_data_type_name(def_type),
-                 ast_data_type_name(node_type));
-        ast_error(msg, node);
-        free(msg);
+        char msg[AST_ERROR_SIZE];
+        snprintf(msg, sizeof(msg),
+                "data type mismatch: `%s %%s' cannot assign the"
+                " expression of type `%s'", ast_data_type_name(def_type),
+                ast_data_type_name(node_type));
+        ast_error(msg, tree->nodes[node], error_scope(a, node));
 
         return 1;
     }
 
     return 0;
 }
-static unsigned int type_check_call_node(node_stack *scope, ast_node *node,
-        ast_node *def_node)
+
+static unsigned int type_check_call_node(analysis *a, ast_index node,
+        ast_index def_node)
 {
-    unsigned int i;
+    const ast_frozen *tree = a->tree;
+    unsigned int i = 0;
     unsigned int error = 0;
 
-    if (AST_NODE_TYPE(def_node) != NODE_FN_HEAD) {
-        ast_error("invalid callee: cannot call variable `%s' as a function",
-                  def_node);
-        return 1;
-    }
+    assert(AST_FROZEN_NODE_TYPE(tree, def_node) == NODE_FN_HEAD);
+    assert(AST_FROZEN_NODE_TYPE(tree, node) == NODE_CALL);
 
-    assert(AST_NODE_TYPE(def_node) == NODE_FN_HEAD);
-    assert(AST_NODE_TYPE(node) == NODE_CALL);
+    ast_index params = def_node + 1;
+    ast_index arguments = node + 1;
+    ast_index param, argument;
 
-    ast_node *params = def_node->children[0];
-    ast_node *arguments = node->children[0];
+    assert(tree->links[def_node].nary && tree->links[node].nary);
 
-    assert(params && arguments);
-
-    if (params->nary > arguments->nary) {
+    if (tree->links[params].nary > tree->links[arguments].nary) {
         ast_error("invalid function call: not enough arguments given for"
-                  " function `%s'", node);
+                  " function `%s'", tree->nodes[node],
+                  error_scope(a, node));
         return 1;
     }
 
-    if (params->nary < arguments->nary) {
+    if (tree->links[params].nary < tree->links[arguments].nary) {
         ast_error("invalid function call: too much arguments given for"
-                  " function `%s'", node);
+                  " function `%s'", tree->nodes[node],
+                  error_scope(a, node));
         return 1;
     }
 
-    for (i = 0; i < arguments->nary; i++) {
-        ast_data_type_flag param_type = AST_DATA_TYPE(params->children[i]);
-        ast_data_type_flag arg_type = node_type_inference(scope,
-                arguments->children[i]);
+    param = tree->links[params].first_child;
+
+    AST_FROZEN_FOREACH_CHILD(tree, arguments, argument) {
+        ast_data_type_flag param_type = AST_FROZEN_DATA_TYPE(tree, param);
+        ast_data_type_flag arg_type = TYPE_OF(a, argument);
 
         if (!param_type || !arg_type)
             error = 1;
         else if (param_type != arg_type) {
-            char *msg = malloc(256 * sizeof(char));
-            snprintf(msg, 256, "data type mismatch: argument %d is of type"
+            char msg[AST_ERROR_SIZE];
+            snprintf(msg, sizeof(msg),
+                    "data type mismatch: argument %d is of type"
                     " `%s' but expected type `%s'", i,
                     ast_data_type_name(arg_type),
                     ast_data_type_name(param_type));
-            ast_error(msg, node);
-            free(msg);
+            ast_error(msg, tree->nodes[node], error_scope(a, node));
 
             error = 1;
         }
+
+        param = tree->links[param].end;
+        i++;
     }
 
     return error;
 }
 
-unsigned int pass_context_analysis(ast_node *root)
+static unsigned int enter_fn_body(analysis *a, ast_index node)
 {
+    const ast_frozen *tree = a->tree;
+    ast_index head = tree->links[node].parent;
     unsigned int error = 0;
-    unsigned int scope;
-    size_t i;
 
-    node_stack **scopes = calloc(SCOPE_LEVEL_LIMIT, sizeof(node_stack *));
+    // Every function body opens a new frame on top of the enclosing scope.
+    scope_push(a->scope);
 
-    if (!root)
-        return 0;
+    // Append the list of current function's arguments to the nested scope.
+    assert(AST_FROZEN_NODE_TYPE(tree, head) == NODE_FN_HEAD);
+    assert(tree->links[head].nary == 2);
+    assert(AST_FROZEN_NODE_TYPE(tree, head + 1) == NODE_BLOCK);
+    assert(tree->links[head + 1].end == node);
 
-    scopes[0] = node_stack_new();
+    if (add_scope_node(a, head + 1))
+        error = 1;
 
-    // Construct a list of all variables defined in the global scope.
-    for (i = 0; i < root->nary; i++)
-        if (AST_NODE_TYPE(root->children[i]) == NODE_VAR_DEC
-                || AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD)
-            node_stack_push(scopes[0], root->children[i]);
+    // Construct a list of all variables defined in the nested scope, and
+    // append the list of all function declarations to it. The preprocess
+    // phase made sure every body has its blocks.
+    ast_index vars_block = node + 1;
+    ast_index func_block = tree->links[vars_block].end;
 
-    AST_TRAVERSE_START(root, node)
+    if (add_scope_node(a, vars_block))
+        error = 1;
 
-    if (AST_NODE_TYPE(node) == NODE_FN_BODY) {
-        scope = scope_level(node->children[0]);
+    if (add_scope_node(a, func_block))
+        error = 1;
 
-        assert(scope > 0);
-        assert(scopes[scope - 1]);
+    // Use type inference to check if the returned value's type matches the
+    // return type of the function header.
+    if (type_check_return_node(a, node))
+        error = 1;
 
-        if (scopes[scope])
-            node_stack_free(scopes[scope]);
+    return error;
+}
 
-        scopes[scope] = node_stack_clone(scopes[scope - 1]);
+static unsigned int check_call(analysis *a, ast_index node)
+{
+    // The callee is resolved when the call is typed. Check if the argument
+    // types match the parameter types of the function header.
+    if (!expr_type(a, node))
+        return 1;
 
-        // Append the list of current function's arguments to the nested scope.
-        assert(AST_NODE_TYPE(node->parent) == NODE_FN_HEAD);
-        assert(node->parent->nary == 2);
-        assert(AST_NODE_TYPE(node->parent->children[0]) == NODE_BLOCK);
-        assert(node->parent->children[1] == node);
+    return type_check_call_node(a, node, a->decls[node]);
+}
 
-        if (add_scope_node(scopes, scope, node->parent->children[0]))
-            error = 1;
+static unsigned int check_assign(analysis *a, ast_index node)
+{
+    // Use type inference to check if the assigned expression type matches
+    // the type of the identifier on the left side of the assignment.
+    ast_index def_node;
 
-        // Construct a list of all variables defined in the nested scope.
-        ast_node *vars_block = get_func_body_block(node, NODE_BLOCK_VARS);
+    if ((def_node = scope_contains_ident(a, node)) == AST_INDEX_NONE)
+        return 1;
 
-        if (!vars_block)
-            return error;
+    a->decls[node] = def_node;
+    a->tree->nodes[node]->decl = a->tree->nodes[def_node];
 
-        if (add_scope_node(scopes, scope, vars_block))
-            error = 1;
+    return type_check_assign_node(a, node, def_node);
+}
 
-        // Append the list of all function declarations to the nested scope.
-        ast_node *func_block = get_func_body_block(node, NODE_BLOCK_FUNCS);
+// Resolve the variable of a for-loop, which the preprocess phase declared in
+// the enclosing function, so the loop lowering can link the nodes it makes.
+static unsigned int check_for(analysis *a, ast_index node)
+{
+    ast_index def_node;
 
-        if (!func_block)
-            return error;
+    if ((def_node = scope_contains_ident(a, node)) == AST_INDEX_NONE)
+        return 1;
 
-        if (add_scope_node(scopes, scope, func_block))
-            error = 1;
+    a->decls[node] = def_node;
+    a->tree->nodes[node]->decl = a->tree->nodes[def_node];
 
-        // Use type inference to check if the returned value's type matches the
-        // return type of the function header.
-        if (type_check_return_node(scopes[scope], node))
-            error = 1;
-    } else if (AST_NODE_TYPE(node) == NODE_CALL) {
-        // Use type inference to check if the argument types match the
-        // parameter types of the function header.
+    return 0;
+}
+
+// Check the frozen tree in a single pre-order scan. The frame of a function
+// body is popped once the scan has left its subtree.
+static unsigned int analyse(analysis *a)
+{
+    const ast_frozen *tree = a->tree;
+    unsigned int error = 0;
+    ast_index i;
 
-        ast_node *def_node;
-        node_stack *vars_scope = get_scope(scopes, node);
+    for (i = 0; i < tree->count; i++) {
+        while (a->depth && tree->links[a->bodies[a->depth - 1]].end <= i) {
+            scope_pop(a->scope);
+            a->depth--;
+        }
 
-        if (!(def_node = scope_contains_ident(vars_scope, node))
-                || type_check_call_node(vars_scope, node, def_node))
-            error = 1;
-    } else if (AST_NODE_TYPE(node) == NODE_ASSIGN) {
-        // Use type inference to check if the assigned expression type matches
-        // the type of the identifier on the left side of the assignment.
-        ast_node *def_node;
-        node_stack *vars_scope = get_scope(scopes, node);
-
-        if (!(def_node = scope_contains_ident(vars_scope, node))
-                || type_check_assign_node(vars_scope, node, def_node))
-            error = 1;
+        switch (AST_FROZEN_NODE_TYPE(tree, i)) {
+        case NODE_FN_BODY:
+            if (a->depth >= a->size) {
+                a->size = a->size ? 2 * a->size : SCOPE_FRAMES_SIZE;
+                a->bodies = realloc(a->bodies, a->size * sizeof(ast_index));
+
+                assert(a->bodies);
+            }
+
+            a->bodies[a->depth++] = i;
+            error |= enter_fn_body(a, i);
+            break;
+        case NODE_CALL:
+            error |= check_call(a, i);
+            break;
+        case NODE_ASSIGN:
+            error |= check_assign(a, i);
+            break;
+        case NODE_FOR:
+            error |= check_for(a, i);
+            break;
+        case NODE_UNARY_OP:
+        case NODE_BIN_OP:
+        case NODE_CAST:
+        case NODE_CONST:
+            // Conditions and loop bounds are typed here; the operands of
+            // expressions that were typed already are looked up.
+            error |= !expr_type(a, i);
+            break;
+        default:
+            break;
+        }
     }
 
-    AST_TRAVERSE_END(root, node)
+    free(a->bodies);
+
+    return error;
+}
+
+unsigned int pass_context_analysis(ast_node *root)
+{
+    unsigned int error;
+    ast_index i;
+
+    if (!root)
+        return 0;
 
-    for (i = 0; scopes[i]; i++)
-        node_stack_free(scopes[i]);
+    ast_frozen *tree = ast_freeze(root);
+    scope_table *scope = scope_table_new();
 
-    free(scopes);
+    if (!tree || !scope) {
+        ast_frozen_free(tree);
+        scope_table_free(scope);
+        return 1;
+    }
+
+    // The analysis relies on the shape of function bodies and loops.
+    ast_frozen_validate(tree);
+
+    scope_push(scope);
+
+    // Construct a list of all variables defined in the global scope. A later
+    // global declaration of the same name replaces an earlier one.
+    AST_FROZEN_FOREACH_CHILD(tree, 0, i)
+        if (AST_FROZEN_NODE_TYPE(tree, i) == NODE_VAR_DEC
+                || AST_FROZEN_NODE_TYPE(tree, i) == NODE_FN_HEAD)
+            scope_bind(scope, tree->data[i].sval, i);
+
+    analysis a = {
+        .tree = tree,
+        .scope = scope,
+        .types = calloc(tree->count, sizeof(uint8_t)),
+        .decls = malloc(tree->count * sizeof(ast_index)),
+    };
+
+    if (!a.types || !a.decls)
+        error = 1;
+    else {
+        memset(a.decls, 0xff, tree->count * sizeof(ast_index));
+        error = analyse(&a);
+    }
+
+    free(a.types);
+    free(a.decls);
+    scope_table_free(scope);
+    ast_frozen_free(tree);
 
     return error;
 }
-
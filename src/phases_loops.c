@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -5,7 +6,9 @@
 #include "phases.h"
 #include "ast.h"
 #include "ast_helpers.h"
+#include "ast_map.h"
 #include "ast_printer.h"
+#include "ast_visitor.h"
 
 static void free_for_loop(ast_node *node)
 {
@@ -33,98 +36,506 @@ static void free_while_loop(ast_node *node)
     ast_free_leaf(node);
 }
 
+static ast_visit_result while_to_do(ast_walker *walker, ast_node *node)
+{
+    // Create the body of the loop
+    ast_node *do_stmt = NEW_DO_WHILE();
+    ast_node_append(do_stmt, node->children[0]);
+    ast_node_append(do_stmt, node->children[1]);
+
+    // Create if statement and its condition
+    ast_node *if_stmt = NEW_IF();
+    ast_node_append(if_stmt, ast_node_clone(node->children[0]));
+    ast_node_append(if_stmt, do_stmt);
+
+    if (!if_stmt) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
+
+    // Replace the while-loop by the if-statement and free its memory. The
+    // if-statement is visited next, which lowers nested loops as well.
+    free_while_loop(node);
+    walker->replacement = if_stmt;
+
+    return AST_VISIT_REPLACE;
+}
+
+const ast_visitor while_to_do_visitor = {
+    .pre = { [NODE_WHILE] = &while_to_do },
+};
+
 unsigned int pass_while_to_do(ast_node *root)
 {
-    AST_TRAVERSE_START(root, node)
+    return ast_walk(root, &while_to_do_visitor, NULL);
+}
 
-    if (AST_NODE_TYPE(node) == NODE_WHILE) {
-        // Create the body of the loop
-        ast_node *do_stmt = NEW_DO_WHILE();
-        ast_node_append(do_stmt, node->children[0]);
-        ast_node_append(do_stmt, node->children[1]);
+// The nodes made for a for-loop refer to its variable and are typed, like
+// the nodes the context analysis has seen.
+static ast_node *typed(ast_node *node, ast_data_type_flag type)
+{
+    if (node)
+        AST_EXPR_TYPE_SET(node, type);
 
-        // Create if statement and its condition
-        ast_node *if_stmt = NEW_IF();
-        ast_node_append(if_stmt, ast_node_clone(node->children[0]));
-        ast_node_append(if_stmt, do_stmt);
+    return node;
+}
 
-        if (!if_stmt)
-            return 1;
+static ast_node *loop_var(ast_node *loop)
+{
+    ast_node *ident = typed(NEW_IDENT(loop->data.sval), NODE_FLAG_INT);
+
+    if (ident)
+        ident->decl = loop->decl;
 
-        // Insert the if-statement before the while-loop node
-        int pos = ast_node_pos(node->parent, node);
-        ast_node_insert(node->parent, if_stmt, pos);
+    return ident;
+}
 
-        // Remove the while-loop from the AST and free its memory
-        ast_node_remove(node->parent, node);
-        free_while_loop(node);
-        node = NULL;
+static ast_node *loop_assign(ast_node *loop, ast_node *value)
+{
+    ast_node *assign = NEW_ASSIGN(loop->data.sval);
+
+    if (assign)
+        assign->decl = loop->decl;
+
+    return ast_node_append(assign, value);
+}
+
+static ast_visit_result for_to_do(ast_walker *walker, ast_node *node)
+{
+    int start = node->children[0]->data.ival;
+    int stop = node->children[1]->data.ival;
+    int step = node->nary == 4 ? node->children[2]->data.ival : 1;
+
+    // Create the initialization statement of the loop counter
+    ast_node *loop_counter = loop_assign(node,
+            typed(NEW_INT(start), NODE_FLAG_INT));
+
+    if (!loop_counter) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
+
+    // A loop that never runs leaves just the initialization.
+    if (start >= stop) {
+        ast_free_node(node->children[node->nary - 1]);
+        free_for_loop(node);
+        walker->replacement = loop_counter;
+
+        return AST_VISIT_REPLACE;
     }
 
-    AST_TRAVERSE_END(root, node)
+    // Create the body of the loop and the loop condition
+    ast_node *do_body = node->children[node->nary - 1];
+
+    ast_node *do_cond = typed(NEW_BIN_OP(OP_LT), NODE_FLAG_BOOL);
+    ast_node_append(do_cond, loop_var(node));
+    ast_node_append(do_cond, typed(NEW_INT(stop), NODE_FLAG_INT));
 
-    return 0;
+    ast_node *do_stmt = NEW_DO_WHILE();
+
+    ast_node_append(do_stmt, do_cond);
+    ast_node_append(do_stmt, do_body);
+
+    // Append loop counter increment statement to loop body
+    ast_node *counter_add = typed(NEW_BIN_OP(OP_ADD), NODE_FLAG_INT);
+
+    ast_node_append(counter_add, loop_var(node));
+    ast_node_append(counter_add, typed(NEW_INT(step), NODE_FLAG_INT));
+
+    ast_node_append(do_body, loop_assign(node, counter_add));
+
+    if (!do_stmt) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
+
+    // The loop keeps its variable and step, which the increment at the end
+    // of the body adds, for the induction-variable optimizations.
+    do_stmt->decl = node->decl;
+    do_stmt->data.ival = step;
+
+    // Insert the loop-counter-var in front of the for-loop and replace the
+    // for-loop by the do-while. The bounds are constants and the loop runs
+    // at least once, so unlike a while-loop it needs no guard that compares
+    // them. The do-while is visited next, which lowers nested loops as well.
+    ast_walk_insert(walker, loop_counter);
+
+    free_for_loop(node);
+    walker->replacement = do_stmt;
+
+    return AST_VISIT_REPLACE;
 }
 
+const ast_visitor for_to_do_visitor = {
+    .pre = { [NODE_FOR] = &for_to_do },
+};
+
 unsigned int pass_for_to_do(ast_node *root)
 {
-    AST_TRAVERSE_START(root, node)
+    return ast_walk(root, &for_to_do_visitor, NULL);
+}
 
-    if (AST_NODE_TYPE(node) == NODE_FOR) {
-        // Create the initialization statement of the loop counter
-        ast_node *loop_counter = NEW_ASSIGN(strdup(node->data.sval));
-        ast_node_append(loop_counter, NEW_INT(node->children[0]->data.ival));
+// Loops with a known trip count are unrolled before they are lowered: fully
+// when all copies of the body take at most the limit in nodes, and otherwise
+// by the factor, with the iterations that are left over unrolled after the
+// loop. The limit and factor are set once for the process.
+static unsigned int unroll_limit = UNROLL_LIMIT;
+static unsigned int unroll_factor = UNROLL_FACTOR;
 
-        // Create the body of the loop and the loop condition
-        ast_node *do_body = node->children[node->nary - 1];
+void loops_set_unroll(unsigned int limit, unsigned int factor)
+{
+    unroll_limit = limit;
+    unroll_factor = factor;
+}
 
-        ast_node *if_cond = NEW_BIN_OP(OP_LT);
-        ast_node_append(if_cond, NEW_IDENT(strdup(node->data.sval)));
-        ast_node_append(if_cond, NEW_INT(node->children[1]->data.ival));
+// The locals that any code assigns, and the locals that functions nested in
+// the function that declares them read. A copy of the body does not store
+// the loop variable, so a function it calls would read a stale value.
+typedef struct {
+    ast_map assigned;
+    ast_map nested_reads;
+    unsigned int error;
+} unrolling;
+
+// The loop variable in a copy of the body: a constant, or, in a partially
+// unrolled loop, the variable plus a constant.
+typedef struct {
+    ast_node *loop;
+    int constant;
+    int value;
+} unroll_copy;
+
+static ast_visit_result mark_assigned(ast_walker *walker, ast_node *node)
+{
+    unrolling *u = walker->data;
+    uintptr_t *assigned;
 
-        ast_node *do_stmt = NEW_DO_WHILE();
+    if (!node->decl)
+        return AST_VISIT_CONTINUE;
 
-        ast_node_append(do_stmt, if_cond);
-        ast_node_append(do_stmt, do_body);
+    if (!(assigned = ast_map_get(&u->assigned, node->decl))) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
 
-        // Append loop counter increment statement to loop body
-        ast_node *counter_incr = NEW_ASSIGN(strdup(node->data.sval));
-        ast_node *counter_add = NEW_BIN_OP(OP_ADD);
+    *assigned = 1;
 
-        ast_node_append(counter_add, NEW_IDENT(strdup(node->data.sval)));
-        ast_node_append(counter_add, NEW_INT(
-                    node->nary == 4 ? node->children[2]->data.ival : 1));
+    return AST_VISIT_CONTINUE;
+}
 
-        ast_node_append(counter_incr, counter_add);
-        ast_node_append(do_body, counter_incr);
+static ast_visit_result mark_nested_read(ast_walker *walker, ast_node *node)
+{
+    unrolling *u = walker->data;
+    ast_node *owner;
+    uintptr_t *read;
+
+    if (AST_DATA_TYPE(node) != NODE_FLAG_IDENT || !node->decl
+            || !node->decl->parent || !(owner = node->decl->parent->parent)
+            || AST_NODE_TYPE(owner) != NODE_FN_BODY
+            || owner == ast_walk_fn_body(walker))
+        return AST_VISIT_CONTINUE;
+
+    if (!(read = ast_map_get(&u->nested_reads, node->decl))) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
 
-        // Create if statement and its condition (e.g. "if (i < 4) ...")
-        if_cond = NEW_BIN_OP(OP_LT);
+    *read = 1;
 
-        ast_node_append(if_cond, NEW_IDENT(strdup(node->data.sval)));
-        ast_node_append(if_cond, NEW_INT(node->children[1]->data.ival));
+    return AST_VISIT_CONTINUE;
+}
 
-        ast_node *if_stmt = NEW_IF();
+static int is_int_constant(const ast_node *node)
+{
+    return AST_NODE_TYPE(node) == NODE_CONST
+        && AST_DATA_TYPE(node) == NODE_FLAG_INT;
+}
 
-        ast_node_append(if_stmt, if_cond);
-        ast_node_append(if_stmt, do_stmt);
+// Whether a statement changes the loop variable, including as the variable
+// of an inner loop.
+static int assigns_var(const ast_node *node, const ast_node *decl)
+{
+    unsigned int i;
 
-        if (!if_stmt)
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_ASSIGN:
+        return node->decl == decl;
+    case NODE_FOR:
+        if (node->decl == decl)
             return 1;
 
-        // Insert the loop-counter-var at the for-loop's position and the
-        // if-statement after the loop-counter-var
-        int pos = ast_node_pos(node->parent, node);
-        ast_node_insert(node->parent, loop_counter, pos);
-        ast_node_insert(node->parent, if_stmt, pos + 1);
+        return assigns_var(node->children[node->nary - 1], decl);
+    case NODE_BLOCK:
+    case NODE_IF:
+    case NODE_WHILE:
+    case NODE_DO_WHILE:
+        for (i = 0; i < node->nary; i++)
+            if (assigns_var(node->children[i], decl))
+                return 1;
+
+        return 0;
+    default:
+        return 0;
+    }
+}
 
-        // Remove the for-loop from the AST and free its memory
-        ast_node_remove(node->parent, node);
-        free_for_loop(node);
-        node = NULL;
+static ast_node *copy_value(const unroll_copy *copy)
+{
+    ast_node *sum;
+
+    if (copy->constant)
+        return typed(NEW_INT(copy->value), NODE_FLAG_INT);
+
+    sum = typed(NEW_BIN_OP(OP_ADD), NODE_FLAG_INT);
+    ast_node_append(sum, loop_var(copy->loop));
+
+    return ast_node_append(sum, typed(NEW_INT(copy->value), NODE_FLAG_INT));
+}
+
+static int substitute_var(ast_node *node, const unroll_copy *copy)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->nary; i++) {
+        ast_node *child = node->children[i], *value;
+
+        if (AST_NODE_TYPE(child) != NODE_CONST
+                || AST_DATA_TYPE(child) != NODE_FLAG_IDENT
+                || child->decl != copy->loop->decl) {
+            if (!substitute_var(child, copy))
+                return 0;
+
+            continue;
+        }
+
+        if (!(value = copy_value(copy)))
+            return 0;
+
+        value->offset = child->offset;
+        node->children[i] = value;
+        value->parent = node;
+        ast_free_node(child);
     }
 
-    AST_TRAVERSE_END(root, node)
+    return 1;
+}
+
+// Append a copy of the statements of the body to a block.
+static int append_copy(ast_node *block, ast_node *body,
+        const unroll_copy *copy)
+{
+    ast_node *clone = ast_node_clone(body);
+    unsigned int i;
+
+    // The variable itself needs no substitution.
+    if (!clone || (!(!copy->constant && !copy->value)
+                && !substitute_var(clone, copy))
+            || !ast_node_reserve(block, block->nary + clone->nary)) {
+        ast_free_node(clone);
+        return 0;
+    }
+
+    for (i = 0; i < clone->nary; i++)
+        ast_node_append(block, clone->children[i]);
+
+    ast_free_leaf(clone);
+
+    return 1;
+}
+
+// The statements that replace a for-loop, or NULL if it is not unrolled.
+// The loop variable ends with the value the lowered loop leaves in it.
+static ast_node *unroll_for(unrolling *u, ast_node *loop)
+{
+    ast_node *body = loop->children[loop->nary - 1], *block;
+    ast_node *groups, *groups_body;
+    long long start, stop, step, trips, last, size, factor, k;
+    unroll_copy copy = {.loop = loop};
+
+    if (!loop->decl || !is_int_constant(loop->children[0])
+            || !is_int_constant(loop->children[1])
+            || (loop->nary == 4 && !is_int_constant(loop->children[2]))
+            || ast_map_lookup(&u->assigned, loop->decl)
+            || ast_map_lookup(&u->nested_reads, loop->decl)
+            || assigns_var(body, loop->decl))
+        return NULL;
+
+    start = loop->children[0]->data.ival;
+    stop = loop->children[1]->data.ival;
+    step = loop->nary == 4 ? loop->children[2]->data.ival : 1;
+
+    // The lowering compares with < for any step, which only ends for
+    // positive ones.
+    if (step <= 0)
+        return NULL;
+
+    trips = start < stop ? (stop - start + step - 1) / step : 0;
+    last = start + trips * step;
+    size = ast_node_count(body);
+
+    if (last > INT_MAX || !(block = NEW_BLOCK()))
+        return NULL;
+
+    copy.constant = 1;
+
+    if (trips * size <= unroll_limit) {
+        for (k = 0; k < trips; k++) {
+            copy.value = start + k * step;
+
+            if (!append_copy(block, body, &copy))
+                goto error;
+        }
+    } else {
+        factor = unroll_factor;
+
+        if (factor < 2 || factor * size > unroll_limit || trips < factor
+                || factor * step > INT_MAX) {
+            ast_free_node(block);
+            return NULL;
+        }
+
+        // The loop that is left runs whole groups of iterations, with the
+        // variable at the first iteration of the group.
+        groups = NEW_FOR();
+        groups_body = NEW_BLOCK();
+
+        if (!groups || !groups_body) {
+            ast_free_node(groups);
+            ast_free_node(groups_body);
+            goto error;
+        }
+
+        groups->data.sval = loop->data.sval;
+        groups->decl = loop->decl;
+        groups->offset = loop->offset;
+
+        ast_node_append(groups, typed(NEW_INT(start), NODE_FLAG_INT));
+        ast_node_append(groups, typed(NEW_INT(start
+                        + trips / factor * factor * step), NODE_FLAG_INT));
+        ast_node_append(groups, typed(NEW_INT(factor * step),
+                    NODE_FLAG_INT));
+
+        ast_node_append(groups, groups_body);
+
+        if (!ast_node_append(block, groups))
+            goto error;
+
+        copy.constant = 0;
+
+        for (k = 0; k < factor; k++) {
+            copy.value = k * step;
+
+            if (!append_copy(groups_body, body, &copy))
+                goto error;
+        }
+
+        copy.constant = 1;
+
+        for (k = trips / factor * factor; k < trips; k++) {
+            copy.value = start + k * step;
+
+            if (!append_copy(block, body, &copy))
+                goto error;
+        }
+
+        if (!(trips % factor))
+            return block;
+    }
+
+    if (!ast_node_append(block, loop_assign(loop, typed(NEW_INT(last),
+                        NODE_FLAG_INT))))
+        goto error;
+
+    return block;
+
+error:
+    u->error = 1;
+    ast_free_node(block);
+
+    return NULL;
+}
+
+// Unroll the loops in a block of statements, inner loops first.
+static void unroll_block(unrolling *u, ast_node *block)
+{
+    size_t i, j;
+
+    for (i = 0; i < block->nary && !u->error; i++) {
+        ast_node *stmt = block->children[i], *unrolled;
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_DO_WHILE:
+            for (j = 1; j < stmt->nary; j++)
+                unroll_block(u, stmt->children[j]);
+
+            continue;
+        case NODE_FOR:
+            unroll_block(u, stmt->children[stmt->nary - 1]);
+            break;
+        default:
+            continue;
+        }
+
+        if (!(unrolled = unroll_for(u, stmt)))
+            continue;
+
+        if (!ast_node_reserve(block, block->nary - 1 + unrolled->nary)) {
+            u->error = 1;
+            ast_free_node(unrolled);
+            return;
+        }
+
+        ast_node_remove(block, i);
+
+        for (j = 0; j < unrolled->nary; j++)
+            ast_node_insert(block, unrolled->children[j], i + j);
+
+        // The copies are not unrolled again.
+        i += unrolled->nary - 1;
+
+        ast_free_leaf(unrolled);
+        ast_free_node(stmt);
+    }
+}
+
+static void unroll_fn_body(unrolling *u, ast_node *body)
+{
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    size_t i;
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            unroll_fn_body(u, funcs->children[i]->children[1]);
+
+    unroll_block(u, body->children[NODE_BLOCK_STMTS]);
+}
+
+unsigned int pass_unroll_loops(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = {
+            [NODE_ASSIGN] = &mark_assigned,
+            [NODE_CONST] = &mark_nested_read,
+        },
+    };
+
+    unrolling u = {.error = 0};
+    size_t i;
+
+    if (!root || !unroll_limit)
+        return 0;
+
+    u.error = ast_walk(root, &visitor, &u);
+
+    for (i = 0; !u.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            unroll_fn_body(&u, root->children[i]->children[1]);
+
+    ast_map_free(&u.assigned);
+    ast_map_free(&u.nested_reads);
 
-    return 0;
+    return u.error;
 }
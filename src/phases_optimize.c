@@ -0,0 +1,2949 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "phases.h"
+#include "ast.h"
+#include "ast_helpers.h"
+#include "ast_map.h"
+#include "ast_visitor.h"
+#include "stats.h"
+
+static int is_constant(const ast_node *node)
+{
+    return AST_NODE_TYPE(node) == NODE_CONST
+        && AST_DATA_TYPE(node) != NODE_FLAG_IDENT;
+}
+
+// A constant in the place of an expression, typed and located like it.
+static ast_node *new_constant(const ast_node *node, ast_data_type_flag type,
+        ast_data_type data)
+{
+    ast_node *constant = ast_flag_set(ast_new_node(NODE_CONST, data), type);
+
+    if (constant) {
+        AST_EXPR_TYPE_SET(constant, type);
+        constant->offset = node->offset;
+    }
+
+    return constant;
+}
+
+static ast_node *new_int(const ast_node *node, int value)
+{
+    return new_constant(node, NODE_FLAG_INT, (ast_data_type){.ival = value});
+}
+
+static ast_node *new_bool(const ast_node *node, int value)
+{
+    return new_constant(node, NODE_FLAG_BOOL,
+            (ast_data_type){.ival = !!value});
+}
+
+// Floats that are not finite have no literal, so they are left to run time.
+static ast_node *new_float(const ast_node *node, double value)
+{
+    if (!isfinite(value))
+        return NULL;
+
+    return new_constant(node, NODE_FLAG_FLOAT, (ast_data_type){.dval = value});
+}
+
+static ast_node *fold_unary(ast_node *node, const ast_node *a)
+{
+    switch (node->data.ival) {
+    case OP_NEG:
+        if (AST_DATA_TYPE(a) == NODE_FLAG_INT)
+            return new_int(node, -(unsigned int) a->data.ival);
+
+        if (AST_DATA_TYPE(a) == NODE_FLAG_FLOAT)
+            return new_float(node, -a->data.dval);
+
+        return NULL;
+    case OP_NOT:
+        if (AST_DATA_TYPE(a) == NODE_FLAG_BOOL)
+            return new_bool(node, !a->data.ival);
+
+        return NULL;
+    default:
+        return NULL;
+    }
+}
+
+static ast_node *fold_int(ast_node *node, int x, int y)
+{
+    switch (node->data.ival) {
+    case OP_ADD: return new_int(node, (unsigned int) x + (unsigned int) y);
+    case OP_SUB: return new_int(node, (unsigned int) x - (unsigned int) y);
+    case OP_MUL: return new_int(node, (unsigned int) x * (unsigned int) y);
+    case OP_DIV:
+    case OP_MOD:
+        // Division by zero traps at run time, and so does the one quotient
+        // that does not fit.
+        if (!y || (x == INT_MIN && y == -1))
+            return NULL;
+
+        return new_int(node, node->data.ival == OP_DIV ? x / y : x % y);
+    case OP_LE: return new_bool(node, x <= y);
+    case OP_LT: return new_bool(node, x < y);
+    case OP_GE: return new_bool(node, x >= y);
+    case OP_GT: return new_bool(node, x > y);
+    case OP_EQ: return new_bool(node, x == y);
+    case OP_NE: return new_bool(node, x != y);
+    default: return NULL;
+    }
+}
+
+static ast_node *fold_float(ast_node *node, double x, double y)
+{
+    switch (node->data.ival) {
+    case OP_ADD: return new_float(node, x + y);
+    case OP_SUB: return new_float(node, x - y);
+    case OP_MUL: return new_float(node, x * y);
+    case OP_DIV: return y != 0 ? new_float(node, x / y) : NULL;
+    case OP_LE: return new_bool(node, x <= y);
+    case OP_LT: return new_bool(node, x < y);
+    case OP_GE: return new_bool(node, x >= y);
+    case OP_GT: return new_bool(node, x > y);
+    case OP_EQ: return new_bool(node, x == y);
+    case OP_NE: return new_bool(node, x != y);
+    default: return NULL;
+    }
+}
+
+static ast_node *fold_bool(ast_node *node, int x, int y)
+{
+    switch (node->data.ival) {
+    case OP_EQ: return new_bool(node, x == y);
+    case OP_NE: return new_bool(node, x != y);
+    case OP_AND:
+    case OP_LAND: return new_bool(node, x && y);
+    case OP_OR:
+    case OP_LOR: return new_bool(node, x || y);
+    default: return NULL;
+    }
+}
+
+static ast_node *fold_binary(ast_node *node, const ast_node *a,
+        const ast_node *b)
+{
+    if (AST_DATA_TYPE(a) != AST_DATA_TYPE(b))
+        return NULL;
+
+    switch (AST_DATA_TYPE(a)) {
+    case NODE_FLAG_INT: return fold_int(node, a->data.ival, b->data.ival);
+    case NODE_FLAG_FLOAT: return fold_float(node, a->data.dval, b->data.dval);
+    case NODE_FLAG_BOOL: return fold_bool(node, a->data.ival, b->data.ival);
+    default: return NULL;
+    }
+}
+
+static ast_node *fold_cast(ast_node *node, const ast_node *a)
+{
+    double x = AST_DATA_TYPE(a) == NODE_FLAG_FLOAT ? a->data.dval
+        : a->data.ival;
+
+    switch (node->data.ival) {
+    case NODE_FLAG_INT:
+        // Floats convert by truncation; those out of range have no int.
+        if (!(x > (double) INT_MIN - 1 && x < (double) INT_MAX + 1))
+            return NULL;
+
+        return new_int(node, (int) x);
+    case NODE_FLAG_FLOAT:
+        return new_float(node, x);
+    case NODE_FLAG_BOOL:
+        return new_bool(node, x != 0);
+    default:
+        return NULL;
+    }
+}
+
+// The constant an operator evaluates to for the given constant operands, or
+// NULL when it cannot be known before run time.
+static ast_node *fold_operator(ast_node *node, ast_node **operands)
+{
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_UNARY_OP:
+        return fold_unary(node, operands[0]);
+    case NODE_BIN_OP:
+        return fold_binary(node, operands[0], operands[1]);
+    case NODE_CAST:
+        return fold_cast(node, operands[0]);
+    default:
+        return NULL;
+    }
+}
+
+static ast_node *fold_node(ast_node *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->nary; i++)
+        if (!is_constant(node->children[i]))
+            return NULL;
+
+    return fold_operator(node, node->children);
+}
+
+// Operators are visited after their operands, so a whole constant
+// expression folds bottom-up in a single walk.
+static ast_visit_result fold_constants(ast_walker *walker, ast_node *node)
+{
+    ast_node *folded = fold_node(node);
+
+    if (!folded)
+        return AST_VISIT_CONTINUE;
+
+    ast_free_node(node);
+    walker->replacement = folded;
+
+    return AST_VISIT_REPLACE;
+}
+
+const ast_visitor fold_constants_visitor = {
+    .post = {
+        [NODE_UNARY_OP] = &fold_constants,
+        [NODE_BIN_OP] = &fold_constants,
+        [NODE_CAST] = &fold_constants,
+    },
+};
+
+unsigned int pass_fold_constants(ast_node *root)
+{
+    return ast_walk(root, &fold_constants_visitor, NULL);
+}
+
+// What the propagation knows about the locals: the number of assignments to
+// each declaration, the names assigned without a known declaration, and the
+// constant of each local that holds one.
+typedef struct {
+    ast_map assigns;
+    ast_map unresolved;
+    ast_map values;
+    unsigned int error;
+} propagation;
+
+static ast_visit_result count_assign(ast_walker *walker, ast_node *node)
+{
+    propagation *p = walker->data;
+    uintptr_t *count = node->decl ? ast_map_get(&p->assigns, node->decl)
+        : ast_map_get(&p->unresolved, node->data.sval);
+
+    if (!count) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
+
+    (*count)++;
+
+    return AST_VISIT_CONTINUE;
+}
+
+// Put the constants of the locals of a function into an expression or
+// statement, and fold the operators that become constant. Returns the node
+// that takes the place of the given one, which is then freed by the caller.
+static ast_node *substitute(propagation *p, ast_node *node, ast_node *vars)
+{
+    ast_node *value, *copy;
+    unsigned int i;
+
+    if (AST_NODE_TYPE(node) == NODE_CONST) {
+        if (AST_DATA_TYPE(node) != NODE_FLAG_IDENT || !node->decl
+                || node->decl->parent != vars
+                || !(value = (ast_node *) ast_map_lookup(&p->values,
+                        node->decl)))
+            return node;
+
+        if (!(copy = new_constant(node, AST_DATA_TYPE(value), value->data)))
+            p->error = 1;
+
+        return copy ? copy : node;
+    }
+
+    for (i = 0; i < node->nary; i++) {
+        ast_node *child = node->children[i];
+        ast_node *replacement = substitute(p, child, vars);
+
+        if (replacement != child) {
+            node->children[i] = replacement;
+            replacement->parent = node;
+            ast_free_node(child);
+        }
+    }
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_UNARY_OP:
+    case NODE_BIN_OP:
+    case NODE_CAST:
+        value = fold_node(node);
+        return value ? value : node;
+    default:
+        return node;
+    }
+}
+
+// Propagate the locals of a function that are assigned a constant exactly
+// once, by a statement at the top level of its body. Every statement after
+// that one, and the return value, runs after the assignment and sees the
+// constant. Uses in nested functions are left alone, as those may be called
+// before the assignment.
+static void propagate_fn_body(propagation *p, ast_node *body)
+{
+    ast_node *vars = body->children[NODE_BLOCK_VARS];
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    ast_node *stmts = body->children[NODE_BLOCK_STMTS];
+    ast_node *ret, *replacement;
+    unsigned int i;
+
+    for (i = 0; i < stmts->nary; i++) {
+        ast_node *stmt = stmts->children[i], *decl = stmt->decl;
+        uintptr_t *value;
+
+        substitute(p, stmt, vars);
+
+        if (AST_NODE_TYPE(stmt) != NODE_ASSIGN || !decl
+                || decl->parent != vars
+                || !is_constant(stmt->children[0])
+                || ast_map_lookup(&p->assigns, decl) != 1
+                || ast_map_lookup(&p->unresolved, decl->data.sval))
+            continue;
+
+        if (!(value = ast_map_get(&p->values, decl))) {
+            p->error = 1;
+            return;
+        }
+
+        *value = (uintptr_t) stmt->children[0];
+    }
+
+    if (body->nary > NODE_BLOCK_STMTS + 1) {
+        ret = body->children[NODE_BLOCK_STMTS + 1];
+
+        if ((replacement = substitute(p, ret, vars)) != ret) {
+            body->children[NODE_BLOCK_STMTS + 1] = replacement;
+            replacement->parent = body;
+            ast_free_node(ret);
+        }
+    }
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            propagate_fn_body(p, funcs->children[i]->children[1]);
+}
+
+unsigned int pass_propagate_constants(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = { [NODE_ASSIGN] = &count_assign },
+    };
+
+    propagation p = {.error = 0};
+    unsigned int i;
+
+    if (!root)
+        return 0;
+
+    p.error = ast_walk(root, &visitor, &p);
+
+    for (i = 0; !p.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            propagate_fn_body(&p, root->children[i]->children[1]);
+
+    ast_map_free(&p.assigns);
+    ast_map_free(&p.unresolved);
+    ast_map_free(&p.values);
+
+    return p.error;
+}
+
+// What dead code elimination knows about the program: the uses of each
+// declaration, the constants held by the locals of the function at hand, and
+// the locals being removed. Values computed for the locals are kept in a
+// block until the pass ends.
+typedef struct {
+    ast_map reads;
+    ast_map effects;
+    ast_map calls;
+    ast_map escaped;
+    ast_map known;
+    ast_map dead;
+    ast_node *values;
+    int unresolved;
+    size_t removed;
+    unsigned int error;
+} elimination;
+
+static int is_within(const ast_node *node, const ast_node *ancestor)
+{
+    for (; node; node = node->parent)
+        if (node == ancestor)
+            return 1;
+
+    return 0;
+}
+
+static const ast_node *enclosing_body(const ast_node *node)
+{
+    while (node && AST_NODE_TYPE(node) != NODE_FN_BODY)
+        node = node->parent;
+
+    return node;
+}
+
+// Whether an operator is an int division that may trap.
+static int may_trap(const ast_node *node)
+{
+    const ast_node *divisor;
+
+    if (AST_NODE_TYPE(node) != NODE_BIN_OP
+            || (node->data.ival != OP_DIV && node->data.ival != OP_MOD)
+            || AST_EXPR_TYPE(node) != NODE_FLAG_INT)
+        return 0;
+
+    divisor = node->children[1];
+
+    return !is_constant(divisor) || divisor->data.ival == 0
+        || divisor->data.ival == -1;
+}
+
+// Whether evaluating an expression does more than compute its value: calls,
+// and int divisions that may trap.
+static int has_effects(const ast_node *node)
+{
+    unsigned int i;
+
+    if (AST_NODE_TYPE(node) == NODE_CALL || may_trap(node))
+        return 1;
+
+    for (i = 0; i < node->nary; i++)
+        if (has_effects(node->children[i]))
+            return 1;
+
+    return 0;
+}
+
+static void add(elimination *e, ast_map *map, const void *key, int delta)
+{
+    uintptr_t *count = ast_map_get(map, key);
+
+    if (count)
+        *count += delta;
+    else
+        e->error = 1;
+}
+
+// Add (or with a negative delta, remove) the uses in a subtree. Reads of a
+// local in the value assigned to it (target) do not keep it alive, and
+// neither do calls of a function from its own body.
+static void count(elimination *e, ast_node *node, const ast_node *target,
+        int delta)
+{
+    const ast_node *body;
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_CONST:
+        if (AST_DATA_TYPE(node) != NODE_FLAG_IDENT)
+            return;
+
+        if (!node->decl)
+            e->unresolved = 1;
+        else if (node->decl != target)
+            add(e, &e->reads, node->decl, delta);
+
+        return;
+    case NODE_CALL:
+        if (!node->decl)
+            e->unresolved = 1;
+        else if (!is_within(node, node->decl))
+            add(e, &e->calls, node->decl, delta);
+
+        break;
+    case NODE_ASSIGN:
+        if (!node->decl) {
+            e->unresolved = 1;
+            break;
+        }
+
+        if (has_effects(node->children[0]))
+            add(e, &e->effects, node->decl, delta);
+
+        if (delta > 0 && ((body = enclosing_body(node)) == NULL
+                    || body->children[NODE_BLOCK_VARS] != node->decl->parent))
+            add(e, &e->escaped, node->decl, 1);
+
+        target = node->decl;
+        break;
+    default:
+        break;
+    }
+
+    for (i = 0; i < node->nary; i++)
+        count(e, node->children[i], target, delta);
+}
+
+// Drop a subtree that is no longer part of the program.
+static void discard(elimination *e, ast_node *node)
+{
+    if (!node)
+        return;
+
+    count(e, node, NULL, -1);
+    e->removed += ast_node_count(node);
+    ast_free_node(node);
+}
+
+// The locals whose values are followed: those of the function itself that
+// no nested function assigns, so calls do not change them.
+static int is_tracked(elimination *e, const ast_node *decl,
+        const ast_node *vars)
+{
+    return decl && decl->parent == vars && !ast_map_lookup(&e->escaped, decl);
+}
+
+static void set_known(elimination *e, ast_map *known, const ast_node *decl,
+        ast_node *value)
+{
+    uintptr_t *slot;
+
+    if (!value && !ast_map_lookup(known, decl))
+        return;
+
+    if ((slot = ast_map_get(known, decl)))
+        *slot = (uintptr_t) value;
+    else
+        e->error = 1;
+}
+
+// The constant an expression evaluates to, given the known locals, or NULL.
+static ast_node *evaluate(elimination *e, ast_node *node, const ast_map *known)
+{
+    ast_node *operands[2], *value;
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_CONST:
+        if (is_constant(node))
+            return node;
+
+        return node->decl ? (ast_node *) ast_map_lookup(known, node->decl)
+            : NULL;
+    case NODE_UNARY_OP:
+    case NODE_BIN_OP:
+    case NODE_CAST:
+        for (i = 0; i < node->nary; i++)
+            if (!(operands[i] = evaluate(e, node->children[i], known)))
+                return NULL;
+
+        if (!(value = fold_operator(node, operands)))
+            return NULL;
+
+        if (!ast_node_append(e->values, value)) {
+            e->error = 1;
+            return NULL;
+        }
+
+        return value;
+    default:
+        return NULL;
+    }
+}
+
+static int evaluate_bool(elimination *e, ast_node *node, const ast_map *known,
+        int *value)
+{
+    ast_node *constant = evaluate(e, node, known);
+
+    if (!constant || AST_DATA_TYPE(constant) != NODE_FLAG_BOOL)
+        return 0;
+
+    *value = constant->data.ival;
+
+    return 1;
+}
+
+static void assign_known(elimination *e, ast_map *known, ast_node *assign,
+        const ast_node *vars)
+{
+    if (is_tracked(e, assign->decl, vars))
+        set_known(e, known, assign->decl,
+                evaluate(e, assign->children[0], known));
+}
+
+// Forget the values of the locals assigned in a statement.
+static void forget_assigned(elimination *e, ast_map *known, ast_node *node)
+{
+    unsigned int i;
+
+    if (!known->items)
+        return;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_ASSIGN:
+        if (node->decl)
+            set_known(e, known, node->decl, NULL);
+
+        return;
+    case NODE_BLOCK:
+    case NODE_IF:
+    case NODE_DO_WHILE:
+        for (i = 0; i < node->nary; i++)
+            forget_assigned(e, known, node->children[i]);
+
+        return;
+    default:
+        return;
+    }
+}
+
+// Follow the known locals through one run of a block, without changing it.
+static void simulate(elimination *e, ast_map *known, ast_node *block,
+        const ast_node *vars)
+{
+    unsigned int i;
+
+    for (i = 0; i < block->nary; i++) {
+        if (AST_NODE_TYPE(block->children[i]) == NODE_ASSIGN)
+            assign_known(e, known, block->children[i], vars);
+        else
+            forget_assigned(e, known, block->children[i]);
+    }
+}
+
+static int is_block(const ast_node *node)
+{
+    return node && AST_NODE_TYPE(node) == NODE_BLOCK;
+}
+
+// Replace the statement at index in a block by a branch or loop body, which
+// is a block of statements or, as made by the loop lowering, a single one.
+// The block of the branch, if any, is freed.
+static int splice(elimination *e, ast_node *block, size_t index,
+        ast_node *from)
+{
+    unsigned int i;
+
+    if (!is_block(from)) {
+        if (!from) {
+            ast_node_remove(block, index);
+            return 1;
+        }
+
+        block->children[index] = from;
+        from->parent = block;
+
+        return 1;
+    }
+
+    if (!ast_node_reserve(block, block->nary - 1 + from->nary)) {
+        e->error = 1;
+        return 0;
+    }
+
+    ast_node_remove(block, index);
+
+    for (i = 0; i < from->nary; i++)
+        ast_node_insert(block, from->children[i], index + i);
+
+    e->removed++;
+    ast_free_leaf(from);
+
+    return 1;
+}
+
+// Make the known locals those of a saved state again.
+static void restore_known(elimination *e, const ast_map *saved)
+{
+    if (!ast_map_copy(&e->known, saved)) {
+        ast_map_clear(&e->known);
+        e->error = 1;
+    }
+}
+
+static int is_empty_if(const ast_node *node)
+{
+    return AST_NODE_TYPE(node) == NODE_IF
+        && is_block(node->children[1]) && !node->children[1]->nary
+        && (node->nary < 3
+            || (is_block(node->children[2]) && !node->children[2]->nary))
+        && !has_effects(node->children[0]);
+}
+
+static void eliminate_block(elimination *e, ast_node *block,
+        const ast_node *vars);
+
+// A branch that is a single statement is put in a block while it is worked
+// on, and taken out again if it is still one.
+static void eliminate_branch(elimination *e, ast_node *node, size_t index,
+        const ast_node *vars)
+{
+    ast_node *branch = node->children[index], *block;
+
+    if (is_block(branch)) {
+        eliminate_block(e, branch, vars);
+        return;
+    }
+
+    if (!(block = ast_node_append(NEW_BLOCK(), branch))) {
+        e->error = 1;
+        return;
+    }
+
+    node->children[index] = block;
+    block->parent = node;
+    eliminate_block(e, block, vars);
+
+    if (block->nary != 1)
+        return;
+
+    node->children[index] = block->children[0];
+    node->children[index]->parent = node;
+    block->nary = 0;
+    ast_free_leaf(block);
+}
+
+// An if with a known condition is replaced by the branch it takes, and one
+// whose branches are empty is removed. Returns whether the if was removed.
+static int eliminate_if(elimination *e, ast_node *block, size_t index,
+        const ast_node *vars)
+{
+    ast_node *node = block->children[index], *cond = node->children[0];
+    ast_node *taken, *dropped, *otherwise;
+    ast_map entry = {0};
+    int value;
+
+    otherwise = node->nary == 3 ? node->children[2] : NULL;
+
+    if (evaluate_bool(e, cond, &e->known, &value)) {
+        taken = value ? node->children[1] : otherwise;
+        dropped = value ? otherwise : node->children[1];
+
+        if (!splice(e, block, index, taken))
+            return 0;
+
+        discard(e, cond);
+        discard(e, dropped);
+        e->removed++;
+        ast_free_leaf(node);
+
+        return 1;
+    }
+
+    // Both branches start from what is known before the if. After it, the
+    // locals either of them assigns are unknown.
+    if (!ast_map_copy(&entry, &e->known)) {
+        e->error = 1;
+        return 0;
+    }
+
+    eliminate_branch(e, node, 1, vars);
+
+    if (node->nary == 3) {
+        restore_known(e, &entry);
+        eliminate_branch(e, node, 2, vars);
+    }
+
+    restore_known(e, &entry);
+    ast_map_free(&entry);
+    forget_assigned(e, &e->known, node);
+
+    if (!is_empty_if(node))
+        return 0;
+
+    ast_node_remove(block, index);
+    discard(e, node);
+
+    return 1;
+}
+
+// A do-while whose condition is false after the first run of its body is
+// replaced by the body. Returns whether the loop was removed.
+static int eliminate_do_while(elimination *e, ast_node *block, size_t index,
+        const ast_node *vars)
+{
+    ast_node *node = block->children[index];
+    ast_node *cond = node->children[0], *body = node->children[1];
+    ast_map after = {0};
+    int value, repeats = 1;
+
+    if (!ast_map_copy(&after, &e->known)) {
+        e->error = 1;
+        return 0;
+    }
+
+    simulate(e, &after, body, vars);
+
+    if (evaluate_bool(e, cond, &after, &value))
+        repeats = value;
+
+    ast_map_free(&after);
+
+    if (!repeats) {
+        if (!splice(e, block, index, body))
+            return 0;
+
+        discard(e, cond);
+        e->removed++;
+        ast_free_leaf(node);
+
+        return 1;
+    }
+
+    // The body runs with the values known before the loop only for the
+    // locals it does not assign.
+    forget_assigned(e, &e->known, body);
+    eliminate_block(e, body, vars);
+
+    return 0;
+}
+
+// Remove the branches not taken from a statement block, in order, following
+// the constants assigned to the locals of the function on the way.
+static void eliminate_block(elimination *e, ast_node *block,
+        const ast_node *vars)
+{
+    size_t i = 0;
+
+    while (i < block->nary && !e->error) {
+        ast_node *stmt = block->children[i];
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_IF:
+            if (eliminate_if(e, block, i, vars))
+                continue;
+
+            break;
+        case NODE_DO_WHILE:
+            if (eliminate_do_while(e, block, i, vars))
+                continue;
+
+            break;
+        case NODE_ASSIGN:
+            assign_known(e, &e->known, stmt, vars);
+            break;
+        default:
+            break;
+        }
+
+        i++;
+    }
+}
+
+// Remove the functions of a block that are not called, other than by
+// themselves. Removing one may leave others uncalled.
+static void eliminate_funcs(elimination *e, ast_node *funcs)
+{
+    int changed = 1;
+    size_t i;
+
+    while (changed) {
+        changed = 0;
+
+        for (i = 0; i < funcs->nary;) {
+            ast_node *fn = funcs->children[i];
+
+            if (ast_map_lookup(&e->calls, fn)) {
+                i++;
+                continue;
+            }
+
+            ast_node_remove(funcs, i);
+            discard(e, fn);
+            changed = 1;
+        }
+    }
+}
+
+// Remove the assignments to dead locals from the statements of a function
+// body and those of its nested functions, with the ifs that become empty.
+static void remove_assigns(elimination *e, ast_node *node)
+{
+    ast_node *funcs;
+    size_t i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_FN_BODY:
+        remove_assigns(e, node->children[NODE_BLOCK_STMTS]);
+        funcs = node->children[NODE_BLOCK_FUNCS];
+
+        for (i = 0; i < funcs->nary; i++)
+            if (funcs->children[i]->nary == 2)
+                remove_assigns(e, funcs->children[i]->children[1]);
+
+        return;
+    case NODE_BLOCK:
+        for (i = 0; i < node->nary;) {
+            ast_node *stmt = node->children[i];
+
+            if (AST_NODE_TYPE(stmt) != NODE_ASSIGN
+                    || !ast_map_lookup(&e->dead, stmt->decl)) {
+                remove_assigns(e, stmt);
+
+                if (!is_empty_if(stmt)) {
+                    i++;
+                    continue;
+                }
+            }
+
+            ast_node_remove(node, i);
+            discard(e, stmt);
+        }
+
+        return;
+    case NODE_DO_WHILE:
+        // A lowered for-loop refers to its variable.
+        if (node->decl && ast_map_lookup(&e->dead, node->decl))
+            node->decl = NULL;
+
+        // fall through
+    case NODE_IF:
+        for (i = 1; i < node->nary; i++)
+            remove_assigns(e, node->children[i]);
+
+        return;
+    default:
+        return;
+    }
+}
+
+// Remove the locals that are never read, with the assignments to them. An
+// assignment that has effects keeps its local. Removing the assignments may
+// leave other locals unread.
+static void eliminate_vars(elimination *e, ast_node *body)
+{
+    ast_node *vars = body->children[NODE_BLOCK_VARS];
+    size_t i;
+    int found = 1;
+
+    while (found && !e->error) {
+        found = 0;
+        ast_map_clear(&e->dead);
+
+        for (i = 0; i < vars->nary; i++) {
+            ast_node *var = vars->children[i];
+
+            if (AST_NODE_TYPE(var) != NODE_VAR_DEC
+                    || ast_map_lookup(&e->reads, var)
+                    || ast_map_lookup(&e->effects, var))
+                continue;
+
+            add(e, &e->dead, var, 1);
+            found = 1;
+        }
+
+        if (!found)
+            break;
+
+        remove_assigns(e, body);
+
+        for (i = 0; i < vars->nary;) {
+            ast_node *var = vars->children[i];
+
+            if (!ast_map_lookup(&e->dead, var)) {
+                i++;
+                continue;
+            }
+
+            ast_node_remove(vars, i);
+            discard(e, var);
+        }
+    }
+}
+
+// Nested functions are done first, as the uses they drop may leave locals
+// and functions of the enclosing one dead.
+static void eliminate_fn_body(elimination *e, ast_node *body)
+{
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    size_t i;
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            eliminate_fn_body(e, funcs->children[i]->children[1]);
+
+    ast_map_clear(&e->known);
+    eliminate_block(e, body->children[NODE_BLOCK_STMTS],
+            body->children[NODE_BLOCK_VARS]);
+
+    // Removing declarations is only safe when every use was resolved.
+    if (e->unresolved)
+        return;
+
+    eliminate_funcs(e, funcs);
+    eliminate_vars(e, body);
+}
+
+unsigned int pass_eliminate_dead_code(ast_node *root)
+{
+    elimination e = {.error = 0};
+    size_t i;
+
+    if (!root)
+        return 0;
+
+    if (!(e.values = NEW_BLOCK()))
+        return 1;
+
+    count(&e, root, NULL, 1);
+
+    for (i = 0; !e.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            eliminate_fn_body(&e, root->children[i]->children[1]);
+
+    stats_removed(e.removed);
+
+    ast_map_free(&e.reads);
+    ast_map_free(&e.effects);
+    ast_map_free(&e.calls);
+    ast_map_free(&e.escaped);
+    ast_map_free(&e.known);
+    ast_map_free(&e.dead);
+    ast_free_node(e.values);
+
+    return e.error;
+}
+
+// Passes on lowered loops put statements of their own right before a loop,
+// e.g. to compute values the loop uses. The prelude of a loop gives a block
+// of them, or NULL.
+typedef ast_node *(*loop_prelude)(void *data, ast_node *loop);
+
+static int prelude_loops(ast_node *block, loop_prelude prelude, void *data);
+
+// The guard of a lowered while-loop holds the loop alone, so the loop is put
+// in a block with its prelude.
+static int prelude_branch(ast_node *node, size_t index, loop_prelude prelude,
+        void *data)
+{
+    ast_node *loop = node->children[index], *statements;
+
+    if (AST_NODE_TYPE(loop) != NODE_DO_WHILE)
+        return prelude_loops(loop, prelude, data);
+
+    if ((statements = prelude(data, loop))) {
+        ast_node_append(statements, loop);
+        node->children[index] = statements;
+        statements->parent = node;
+    }
+
+    return prelude_loops(loop->children[1], prelude, data);
+}
+
+// Give the do-while loops in a block their preludes, outer loops first. A
+// lowered for-loop has no guard, so its prelude goes right before it, after
+// the initialization of its variable. Returns 0 when out of memory.
+static int prelude_loops(ast_node *block, loop_prelude prelude, void *data)
+{
+    ast_node *statements;
+    size_t i, j;
+
+    if (AST_NODE_TYPE(block) != NODE_BLOCK)
+        return 1;
+
+    for (i = 0; i < block->nary; i++) {
+        ast_node *stmt = block->children[i];
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_IF:
+            for (j = 1; j < stmt->nary; j++)
+                if (!prelude_branch(stmt, j, prelude, data))
+                    return 0;
+
+            break;
+        case NODE_DO_WHILE:
+            if ((statements = prelude(data, stmt))) {
+                if (!ast_node_reserve(block,
+                            block->nary + statements->nary)) {
+                    ast_free_node(statements);
+                    return 0;
+                }
+
+                for (j = 0; j < statements->nary; j++)
+                    ast_node_insert(block, statements->children[j], i++);
+
+                ast_free_leaf(statements);
+            }
+
+            if (!prelude_loops(stmt->children[1], prelude, data))
+                return 0;
+
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 1;
+}
+
+// What loop-invariant code motion knows: the variables that are assigned by
+// a function other than their own, whether each function is pure, and for
+// the loop at hand, the variables it assigns and whether it calls functions
+// that are not. Hoisted expressions are assigned to new locals of the
+// function, by statements collected in a block that goes before the loop.
+typedef struct {
+    ast_map shared;
+    ast_map purity;
+    ast_map assigned;
+    int calls;
+    ast_node *fn;
+    ast_node *hoisted;
+    unsigned int error;
+} hoisting;
+
+enum {
+    PURITY_UNKNOWN,
+    PURITY_VISITING,
+    PURITY_PURE,
+    PURITY_IMPURE,
+};
+
+// Whether a variable is a parameter or local of a defined function.
+static int is_own(const ast_node *fn, const ast_node *decl)
+{
+    return decl && (decl->parent == fn->children[0]
+            || decl->parent == fn->children[1]->children[NODE_BLOCK_VARS]);
+}
+
+static ast_visit_result mark_shared(ast_walker *walker, ast_node *node)
+{
+    const ast_node *body = enclosing_body(node);
+    uintptr_t *shared;
+
+    if (!node->decl || (body && is_own(body->parent, node->decl)))
+        return AST_VISIT_CONTINUE;
+
+    if (!(shared = ast_map_get(walker->data, node->decl))) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
+
+    *shared = 1;
+
+    return AST_VISIT_CONTINUE;
+}
+
+static int is_pure(hoisting *h, const ast_node *fn);
+
+// Whether the statements or expression of a function only use its own
+// parameters and locals, call pure functions, and surely end without a trap.
+// Loops and recursion may not end, so they are not pure.
+static int is_pure_node(hoisting *h, const ast_node *fn, const ast_node *node)
+{
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_FN_BODY:
+        return is_pure_node(h, fn, node->children[NODE_BLOCK_STMTS])
+            && (node->nary <= NODE_BLOCK_STMTS + 1
+                || is_pure_node(h, fn, node->children[NODE_BLOCK_STMTS + 1]));
+    case NODE_CONST:
+        return AST_DATA_TYPE(node) != NODE_FLAG_IDENT
+            || is_own(fn, node->decl);
+    case NODE_ASSIGN:
+        if (!is_own(fn, node->decl))
+            return 0;
+
+        break;
+    case NODE_CALL:
+        if (!node->decl || !is_pure(h, node->decl))
+            return 0;
+
+        break;
+    case NODE_WHILE:
+    case NODE_DO_WHILE:
+    case NODE_FOR:
+        return 0;
+    default:
+        if (may_trap(node))
+            return 0;
+
+        break;
+    }
+
+    for (i = 0; i < node->nary; i++)
+        if (!is_pure_node(h, fn, node->children[i]))
+            return 0;
+
+    return 1;
+}
+
+static int set_purity(hoisting *h, const ast_node *fn, uintptr_t purity)
+{
+    uintptr_t *slot = ast_map_get(&h->purity, fn);
+
+    if (!slot) {
+        h->error = 1;
+        return 0;
+    }
+
+    *slot = purity;
+
+    return purity == PURITY_PURE;
+}
+
+// Functions without a body in this unit are not known to be pure.
+static int is_pure(hoisting *h, const ast_node *fn)
+{
+    uintptr_t purity = ast_map_lookup(&h->purity, fn);
+
+    if (purity != PURITY_UNKNOWN)
+        return purity == PURITY_PURE;
+
+    if (fn->nary != 2)
+        return set_purity(h, fn, PURITY_IMPURE);
+
+    set_purity(h, fn, PURITY_VISITING);
+
+    return set_purity(h, fn, is_pure_node(h, fn, fn->children[1])
+            ? PURITY_PURE : PURITY_IMPURE);
+}
+
+static void collect_assigned(hoisting *h, ast_node *node)
+{
+    uintptr_t *assigned;
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_ASSIGN:
+        if (!node->decl)
+            break;
+
+        if ((assigned = ast_map_get(&h->assigned, node->decl)))
+            *assigned = 1;
+        else
+            h->error = 1;
+
+        break;
+    case NODE_CALL:
+        if (!node->decl || !is_pure(h, node->decl))
+            h->calls = 1;
+
+        break;
+    default:
+        break;
+    }
+
+    for (i = 0; i < node->nary; i++)
+        collect_assigned(h, node->children[i]);
+}
+
+// A variable keeps its value during the loop when the loop does not assign
+// it, and, if the loop calls functions that are not pure, none of those can.
+static int is_invariant_var(hoisting *h, const ast_node *decl)
+{
+    return decl && !ast_map_lookup(&h->assigned, decl)
+        && (!h->calls || (is_own(h->fn, decl)
+                && !ast_map_lookup(&h->shared, decl)));
+}
+
+static int is_hoistable(const ast_node *node)
+{
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_UNARY_OP:
+    case NODE_BIN_OP:
+    case NODE_CAST:
+    case NODE_CALL:
+        return AST_EXPR_TYPE(node) != 0;
+    default:
+        return 0;
+    }
+}
+
+// Move the expression at index of a node to a new local, assigned before
+// the loop.
+static void hoist(hoisting *h, ast_node *node, size_t index)
+{
+    ast_node *expr = node->children[index], *var, *assign, *ident;
+    ast_data_type_flag type = AST_EXPR_TYPE(expr);
+
+    if (!(var = ast_new_local(h->fn->children[1], "licm", type))
+            || !(assign = NEW_ASSIGN(var->data.sval))
+            || !(ident = NEW_IDENT(var->data.sval))
+            || !ast_node_append(h->hoisted, assign)) {
+        h->error = 1;
+        return;
+    }
+
+    AST_EXPR_TYPE_SET(ident, type);
+    ident->decl = assign->decl = var;
+    ident->offset = expr->offset;
+
+    node->children[index] = ident;
+    ident->parent = node;
+    ast_node_append(assign, expr);
+}
+
+// Whether an expression is invariant in the loop. The largest invariant
+// parts of one that is not are hoisted.
+static int scan(hoisting *h, ast_node *node)
+{
+    ast_node *operands = node;
+    uint64_t invariant = 0;
+    int all = 1;
+    size_t i;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_CONST:
+        return AST_DATA_TYPE(node) != NODE_FLAG_IDENT
+            || is_invariant_var(h, node->decl);
+    case NODE_UNARY_OP:
+    case NODE_BIN_OP:
+    case NODE_CAST:
+        all = !may_trap(node);
+        break;
+    case NODE_CALL:
+        operands = node->children[0];
+        all = node->decl && is_pure(h, node->decl);
+        break;
+    default:
+        return 0;
+    }
+
+    for (i = 0; i < operands->nary; i++) {
+        if (scan(h, operands->children[i]) && i < 64)
+            invariant |= 1ull << i;
+        else
+            all = 0;
+    }
+
+    if (all)
+        return 1;
+
+    for (i = 0; i < operands->nary && i < 64; i++)
+        if ((invariant >> i & 1) && is_hoistable(operands->children[i]))
+            hoist(h, operands, i);
+
+    return 0;
+}
+
+static void scan_root(hoisting *h, ast_node *node, size_t index)
+{
+    if (scan(h, node->children[index])
+            && is_hoistable(node->children[index]))
+        hoist(h, node, index);
+}
+
+static void scan_stmt(hoisting *h, ast_node *stmt)
+{
+    size_t i;
+
+    switch (AST_NODE_TYPE(stmt)) {
+    case NODE_ASSIGN:
+    case NODE_IF:
+    case NODE_DO_WHILE:
+        scan_root(h, stmt, 0);
+        break;
+    case NODE_CALL:
+        scan(h, stmt);
+        return;
+    case NODE_BLOCK:
+        for (i = 0; i < stmt->nary; i++)
+            scan_stmt(h, stmt->children[i]);
+
+        return;
+    default:
+        return;
+    }
+
+    for (i = 1; i < stmt->nary; i++)
+        scan_stmt(h, stmt->children[i]);
+}
+
+// The assignments of the expressions hoisted out of a loop, or NULL. They go
+// right before the loop, as its body runs at least once. Outer loops come
+// first, so expressions move out of as many loops as they can.
+static ast_node *hoist_loop(void *data, ast_node *loop)
+{
+    hoisting *h = data;
+
+    ast_map_clear(&h->assigned);
+    h->calls = 0;
+    collect_assigned(h, loop);
+
+    if (!(h->hoisted = NEW_BLOCK())) {
+        h->error = 1;
+        return NULL;
+    }
+
+    scan_stmt(h, loop);
+
+    if (h->hoisted->nary && !h->error)
+        return h->hoisted;
+
+    ast_free_node(h->hoisted);
+
+    return NULL;
+}
+
+static void hoist_fn_body(hoisting *h, ast_node *fn)
+{
+    ast_node *body = fn->children[1];
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    size_t i;
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            hoist_fn_body(h, funcs->children[i]);
+
+    h->fn = fn;
+
+    if (!prelude_loops(body->children[NODE_BLOCK_STMTS], &hoist_loop, h))
+        h->error = 1;
+}
+
+unsigned int pass_hoist_invariants(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = { [NODE_ASSIGN] = &mark_shared },
+    };
+
+    hoisting h = {.error = 0};
+    size_t i;
+
+    if (!root)
+        return 0;
+
+    h.error = ast_walk(root, &visitor, &h.shared);
+
+    for (i = 0; !h.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            hoist_fn_body(&h, root->children[i]);
+
+    ast_map_free(&h.shared);
+    ast_map_free(&h.purity);
+    ast_map_free(&h.assigned);
+
+    return h.error;
+}
+
+// What strength reduction knows: the variables assigned by a function other
+// than their own, and for the loop at hand, its variable and the derived
+// variables that follow a multiple of it plus an offset.
+typedef struct {
+    int factor;
+    int offset;
+    ast_node *var;
+} derived_var;
+
+typedef struct {
+    ast_map shared;
+    ast_node *fn;
+    const ast_node *iv;
+    derived_var *derived;
+    size_t count;
+    size_t size;
+    unsigned int error;
+} reduction;
+
+static int is_int_constant(const ast_node *node)
+{
+    return is_constant(node) && AST_DATA_TYPE(node) == NODE_FLAG_INT;
+}
+
+static int is_var(const ast_node *node, const ast_node *decl)
+{
+    return AST_NODE_TYPE(node) == NODE_CONST
+        && AST_DATA_TYPE(node) == NODE_FLAG_IDENT && node->decl == decl;
+}
+
+static size_t count_assigns(const ast_node *node, const ast_node *decl)
+{
+    size_t count = AST_NODE_TYPE(node) == NODE_ASSIGN && node->decl == decl;
+    unsigned int i;
+
+    for (i = 0; i < node->nary; i++)
+        count += count_assigns(node->children[i], decl);
+
+    return count;
+}
+
+static size_t count_reads(const ast_node *node, const ast_node *decl)
+{
+    size_t count = is_var(node, decl);
+    unsigned int i;
+
+    for (i = 0; i < node->nary; i++)
+        count += count_reads(node->children[i], decl);
+
+    return count;
+}
+
+static ast_node *new_var(const ast_node *decl)
+{
+    ast_node *ident = NEW_IDENT(decl->data.sval);
+
+    if (ident) {
+        AST_EXPR_TYPE_SET(ident, AST_DATA_TYPE(decl));
+        ident->decl = (ast_node *) decl;
+    }
+
+    return ident;
+}
+
+static ast_node *new_binary(ast_op_type op, ast_node *a, ast_node *b)
+{
+    ast_node *node = ast_node_append(ast_node_append(NEW_BIN_OP(op), a), b);
+
+    if (node)
+        AST_EXPR_TYPE_SET(node, NODE_FLAG_INT);
+
+    return node;
+}
+
+static ast_node *new_assign(ast_node *decl, ast_node *value)
+{
+    ast_node *assign = NEW_ASSIGN(decl->data.sval);
+
+    if (assign)
+        assign->decl = decl;
+
+    return ast_node_append(assign, value);
+}
+
+// Whether an expression is the loop variable times a constant.
+static int match_product(const reduction *r, const ast_node *node,
+        int *factor)
+{
+    const ast_node *a, *b;
+
+    if (AST_NODE_TYPE(node) != NODE_BIN_OP || node->data.ival != OP_MUL)
+        return 0;
+
+    a = node->children[0];
+    b = node->children[1];
+
+    if (is_var(a, r->iv) && is_int_constant(b))
+        *factor = b->data.ival;
+    else if (is_int_constant(a) && is_var(b, r->iv))
+        *factor = a->data.ival;
+    else
+        return 0;
+
+    return 1;
+}
+
+// Whether an expression is the loop variable times a constant, plus or
+// minus a constant.
+static int match_derived(const reduction *r, const ast_node *node,
+        int *factor, int *offset)
+{
+    const ast_node *a, *b;
+
+    if (match_product(r, node, factor)) {
+        *offset = 0;
+        return 1;
+    }
+
+    if (AST_NODE_TYPE(node) != NODE_BIN_OP)
+        return 0;
+
+    a = node->children[0];
+    b = node->children[1];
+
+    switch (node->data.ival) {
+    case OP_ADD:
+        if (is_int_constant(a)) {
+            a = node->children[1];
+            b = node->children[0];
+        }
+
+        if (!is_int_constant(b) || !match_product(r, a, factor))
+            return 0;
+
+        *offset = b->data.ival;
+        return 1;
+    case OP_SUB:
+        if (!is_int_constant(b) || !match_product(r, a, factor))
+            return 0;
+
+        *offset = -(unsigned int) b->data.ival;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static ast_node *derive(reduction *r, int factor, int offset)
+{
+    derived_var *d;
+    size_t i;
+
+    for (i = 0; i < r->count; i++)
+        if (r->derived[i].factor == factor && r->derived[i].offset == offset)
+            return r->derived[i].var;
+
+    if (r->count >= r->size) {
+        size_t size = r->size ? 2 * r->size : 8;
+
+        if (!(d = realloc(r->derived, size * sizeof(derived_var))))
+            return NULL;
+
+        r->derived = d;
+        r->size = size;
+    }
+
+    d = r->derived + r->count;
+
+    if (!(d->var = ast_new_local(r->fn->children[1], "iv", NODE_FLAG_INT)))
+        return NULL;
+
+    d->factor = factor;
+    d->offset = offset;
+    r->count++;
+
+    return d->var;
+}
+
+// Replace the derived expressions in a statement by their variables.
+static void reduce_uses(reduction *r, ast_node *node)
+{
+    unsigned int i;
+    int factor, offset;
+
+    for (i = 0; i < node->nary; i++) {
+        ast_node *child = node->children[i], *var, *ident;
+
+        if (!match_derived(r, child, &factor, &offset)) {
+            reduce_uses(r, child);
+            continue;
+        }
+
+        if (!(var = derive(r, factor, offset)) || !(ident = new_var(var))) {
+            r->error = 1;
+            return;
+        }
+
+        ident->offset = child->offset;
+        node->children[i] = ident;
+        ident->parent = node;
+        ast_free_node(child);
+    }
+}
+
+// The constant the loop variable is set to right before the loop, if any.
+static int find_start(const reduction *r, const ast_node *loop, int *start)
+{
+    const ast_node *block = loop->parent, *stmt;
+    size_t i = 0;
+
+    if (!block || AST_NODE_TYPE(block) != NODE_BLOCK)
+        return 0;
+
+    while (i < block->nary && block->children[i] != loop)
+        i++;
+
+    while (i--) {
+        stmt = block->children[i];
+
+        if (AST_NODE_TYPE(stmt) == NODE_ASSIGN && stmt->decl == r->iv) {
+            if (!is_int_constant(stmt->children[0]))
+                return 0;
+
+            *start = stmt->children[0]->data.ival;
+            return 1;
+        }
+
+        if (count_assigns(stmt, r->iv))
+            return 0;
+    }
+
+    return 0;
+}
+
+// The derived variable that can take over the exit test of the loop, or -1.
+// The test compares the loop variable with a constant. When the loop
+// variable is only read to step it, and the values of a derived variable
+// with a positive factor are all ints, comparing that variable instead gives
+// the same result and leaves the loop variable dead.
+static long find_exit(const reduction *r, const ast_node *loop, int start,
+        long long *bound)
+{
+    const ast_node *cond = loop->children[0], *body = loop->children[1];
+    long long step = loop->data.ival, stop, last, low, high;
+    size_t i;
+
+    if (step <= 0 || AST_NODE_TYPE(cond) != NODE_BIN_OP
+            || cond->data.ival != OP_LT || !is_var(cond->children[0], r->iv)
+            || !is_int_constant(cond->children[1])
+            || count_reads(body, r->iv) != 1)
+        return -1;
+
+    // The test is made after each run of the body, which runs at least once.
+    stop = cond->children[1]->data.ival;
+    last = start < stop ? start + (stop - start + step - 1) / step * step
+        : start + step;
+
+    for (i = 0; i < r->count; i++) {
+        const derived_var *d = r->derived + i;
+
+        if (d->factor <= 0)
+            continue;
+
+        low = (long long) start * d->factor + d->offset;
+        high = last * d->factor + d->offset;
+        *bound = stop * d->factor + d->offset;
+
+        if (low >= INT_MIN && high <= INT_MAX && *bound >= INT_MIN
+                && *bound <= INT_MAX)
+            return i;
+    }
+
+    return -1;
+}
+
+// Set a derived variable before the loop and step it at the end of the body.
+static int init_derived(const reduction *r, ast_node *loop, ast_node *prelude,
+        const derived_var *d, int start, int known)
+{
+    ast_node *body = loop->children[1], *value;
+
+    if (known)
+        value = new_int(loop, (unsigned int) start * d->factor + d->offset);
+    else if (d->offset)
+        value = new_binary(OP_ADD, new_binary(OP_MUL, new_var(r->iv),
+                    new_int(loop, d->factor)), new_int(loop, d->offset));
+    else
+        value = new_binary(OP_MUL, new_var(r->iv), new_int(loop, d->factor));
+
+    value = new_assign(d->var, value);
+
+    if (!ast_node_append(prelude, value))
+        return 0;
+
+    value = new_binary(OP_ADD, new_var(d->var),
+            new_int(loop, (unsigned int) loop->data.ival * d->factor));
+
+    return ast_node_append(body, new_assign(d->var, value)) != NULL;
+}
+
+// Whether a statement steps the loop variable by the step of the loop.
+static int is_step(const reduction *r, const ast_node *loop,
+        const ast_node *stmt)
+{
+    const ast_node *value;
+
+    if (AST_NODE_TYPE(stmt) != NODE_ASSIGN || stmt->decl != r->iv)
+        return 0;
+
+    value = stmt->children[0];
+
+    return AST_NODE_TYPE(value) == NODE_BIN_OP && value->data.ival == OP_ADD
+        && is_var(value->children[0], r->iv)
+        && is_int_constant(value->children[1])
+        && value->children[1]->data.ival == loop->data.ival;
+}
+
+// Derived variables are set before a lowered for-loop and stepped after its
+// variable, at the end of the body, so they hold their value throughout the
+// body. The loop variable may only change by that step.
+static ast_node *reduce_loop(void *data, ast_node *loop)
+{
+    reduction *r = data;
+    ast_node *body = loop->children[1], *prelude, *cond;
+    int start = 0, known;
+    long long bound = 0;
+    long exit = -1;
+    size_t i;
+
+    if (!loop->decl || ast_map_lookup(&r->shared, loop->decl) || !body->nary)
+        return NULL;
+
+    r->iv = loop->decl;
+    r->count = 0;
+
+    if (!is_step(r, loop, body->children[body->nary - 1])
+            || count_assigns(body, r->iv) != 1)
+        return NULL;
+
+    for (i = 0; i + 1 < body->nary; i++)
+        reduce_uses(r, body->children[i]);
+
+    if (!r->count || r->error || !(prelude = NEW_BLOCK()))
+        return NULL;
+
+    if ((known = find_start(r, loop, &start)))
+        exit = find_exit(r, loop, start, &bound);
+
+    // The derived variable that takes over the exit test is stepped last, so
+    // that it is the variable of the loop from now on.
+    for (i = 0; i < r->count; i++)
+        if ((long) i != exit && !init_derived(r, loop, prelude,
+                    r->derived + i, start, known))
+            r->error = 1;
+
+    if (exit < 0 || r->error)
+        return prelude;
+
+    if (!init_derived(r, loop, prelude, r->derived + exit, start, known)) {
+        r->error = 1;
+        return prelude;
+    }
+
+    cond = loop->children[0];
+    ast_free_node(cond->children[0]);
+    ast_free_node(cond->children[1]);
+    cond->children[0] = new_var(r->derived[exit].var);
+    cond->children[1] = new_int(cond, bound);
+
+    if (!cond->children[0] || !cond->children[1]) {
+        r->error = 1;
+        return prelude;
+    }
+
+    cond->children[0]->parent = cond->children[1]->parent = cond;
+    loop->decl = r->derived[exit].var;
+    loop->data.ival = (unsigned int) loop->data.ival
+        * r->derived[exit].factor;
+
+    return prelude;
+}
+
+static void reduce_fn_body(reduction *r, ast_node *fn)
+{
+    ast_node *body = fn->children[1];
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    size_t i;
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            reduce_fn_body(r, funcs->children[i]);
+
+    r->fn = fn;
+
+    if (!prelude_loops(body->children[NODE_BLOCK_STMTS], &reduce_loop, r))
+        r->error = 1;
+}
+
+unsigned int pass_reduce_strength(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = { [NODE_ASSIGN] = &mark_shared },
+    };
+
+    reduction r = {.error = 0};
+    size_t i;
+
+    if (!root)
+        return 0;
+
+    r.error = ast_walk(root, &visitor, &r.shared);
+
+    for (i = 0; !r.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            reduce_fn_body(&r, root->children[i]);
+
+    ast_map_free(&r.shared);
+    free(r.derived);
+
+    return r.error;
+}
+
+// Calls to small functions are replaced by copies of their bodies: fixed
+// arguments are assigned to copies of the parameters, the statements follow
+// and the result is assigned to a temporary. Functions are inlined into
+// their callers before the callers themselves are inlined, so the depth of a
+// function is how deep copies are nested in it.
+static unsigned int inline_limit = INLINE_LIMIT;
+static unsigned int inline_depth = INLINE_DEPTH;
+
+void optimize_set_inline(unsigned int limit, unsigned int depth)
+{
+    inline_limit = limit;
+    inline_depth = depth;
+}
+
+// What inlining knows about a function. index and low are those of Tarjan's
+// algorithm, which finds the functions that call themselves, directly or
+// through others.
+typedef struct {
+    ast_node *fn;
+    unsigned int index;
+    unsigned int low;
+    unsigned int depth;
+    size_t calls;
+    int on_stack;
+    int recursive;
+} inline_fn;
+
+typedef struct {
+    ast_map fns;
+    inline_fn *info;
+    size_t count;
+    size_t size;
+    size_t *stack;
+    size_t top;
+    size_t *order;
+    size_t done;
+    unsigned int next;
+    ast_map shared;
+    ast_map renamed;
+    size_t caller;
+    unsigned int error;
+} inlining;
+
+static void collect_fn(inlining *in, ast_node *fn)
+{
+    ast_node *funcs;
+    uintptr_t *slot;
+    size_t i;
+
+    if (fn->nary != 2)
+        return;
+
+    if (in->count >= in->size) {
+        size_t size = in->size ? 2 * in->size : 16;
+        inline_fn *info = realloc(in->info, size * sizeof(inline_fn));
+
+        if (!info) {
+            in->error = 1;
+            return;
+        }
+
+        in->info = info;
+        in->size = size;
+    }
+
+    if (!(slot = ast_map_get(&in->fns, fn))) {
+        in->error = 1;
+        return;
+    }
+
+    in->info[in->count] = (inline_fn){.fn = fn};
+    *slot = ++in->count;
+
+    funcs = fn->children[1]->children[NODE_BLOCK_FUNCS];
+
+    for (i = 0; i < funcs->nary; i++)
+        collect_fn(in, funcs->children[i]);
+}
+
+static void connect_fn(inlining *in, size_t fn);
+
+// Count the calls in a function and follow them, leaving out its nested
+// functions, which are visited on their own.
+static void connect_calls(inlining *in, size_t fn, const ast_node *node)
+{
+    uintptr_t callee;
+    size_t i;
+
+    if (AST_NODE_TYPE(node) == NODE_CALL
+            && (callee = ast_map_lookup(&in->fns, node->decl))) {
+        inline_fn *info = in->info + --callee;
+
+        info->calls++;
+
+        if (callee == fn)
+            info->recursive = 1;
+
+        if (!info->index) {
+            connect_fn(in, callee);
+
+            if (in->info[callee].low < in->info[fn].low)
+                in->info[fn].low = in->info[callee].low;
+        } else if (info->on_stack && info->index < in->info[fn].low) {
+            in->info[fn].low = info->index;
+        }
+    }
+
+    for (i = 0; i < node->nary; i++)
+        connect_calls(in, fn, node->children[i]);
+}
+
+static void connect_fn(inlining *in, size_t fn)
+{
+    inline_fn *info = in->info + fn;
+    ast_node *body = info->fn->children[1];
+    size_t member, first, i;
+
+    info->index = info->low = ++in->next;
+    info->on_stack = 1;
+    in->stack[in->top++] = fn;
+
+    for (i = 0; i < body->nary; i++)
+        if (i != NODE_BLOCK_FUNCS)
+            connect_calls(in, fn, body->children[i]);
+
+    if (info->low != info->index)
+        return;
+
+    // The functions of a cycle are all recursive. They are done after the
+    // functions they call.
+    first = in->done;
+
+    do {
+        member = in->stack[--in->top];
+        in->info[member].on_stack = 0;
+        in->order[in->done++] = member;
+    } while (member != fn);
+
+    for (i = first; in->done - first > 1 && i < in->done; i++)
+        in->info[in->order[i]].recursive = 1;
+}
+
+static int is_nested(const ast_node *fn)
+{
+    return fn->parent && fn->parent->parent
+        && AST_NODE_TYPE(fn->parent->parent) == NODE_FN_BODY;
+}
+
+static const ast_node *find_name(const ast_node *block, symbol name)
+{
+    size_t i;
+
+    for (i = 0; i < block->nary; i++)
+        if (ast_has_symbol(block->children[i])
+                && block->children[i]->data.sval == name)
+            return block->children[i];
+
+    return NULL;
+}
+
+// The declaration a name refers to in a function: its own, or that of an
+// enclosing function or of the program.
+static const ast_node *resolve_name(const ast_node *fn, symbol name)
+{
+    const ast_node *body, *decl;
+
+    for (;;) {
+        body = fn->children[1];
+
+        if ((decl = find_name(fn->children[0], name))
+                || (decl = find_name(body->children[NODE_BLOCK_VARS], name))
+                || (decl = find_name(body->children[NODE_BLOCK_FUNCS], name)))
+            return decl;
+
+        if (!is_nested(fn))
+            return fn->parent ? find_name(fn->parent, name) : NULL;
+
+        fn = fn->parent->parent->parent;
+    }
+}
+
+// Whether a name of the callee that is not its own would refer to another
+// declaration in the caller, which shadows it.
+static int is_captured(const ast_node *caller, const ast_node *callee,
+        const ast_node *node)
+{
+    unsigned int i;
+
+    if (node->decl && ast_has_symbol(node) && !is_own(callee, node->decl)
+            && resolve_name(caller, node->data.sval) != node->decl)
+        return 1;
+
+    for (i = 0; i < node->nary; i++)
+        if (is_captured(caller, callee, node->children[i]))
+            return 1;
+
+    return 0;
+}
+
+// Whether a call is inlined. The cost of a function is the number of nodes
+// of its statements and result, which are copied. A nested function that is
+// called once is inlined whatever its cost, as it is removed afterwards.
+static int should_inline(const inlining *in, const ast_node *call,
+        size_t *callee)
+{
+    uintptr_t fn = ast_map_lookup(&in->fns, call->decl);
+    const inline_fn *info;
+    const ast_node *body;
+    size_t cost;
+
+    if (!fn)
+        return 0;
+
+    info = in->info + fn - 1;
+    body = info->fn->children[1];
+
+    if (info->recursive || info->depth >= inline_depth
+            || body->children[NODE_BLOCK_FUNCS]->nary)
+        return 0;
+
+    *callee = fn - 1;
+
+    cost = ast_node_count(body->children[NODE_BLOCK_STMTS]);
+
+    if (body->nary == 4)
+        cost += ast_node_count(body->children[3]);
+
+    if (cost > inline_limit && !(info->calls == 1 && is_nested(info->fn)))
+        return 0;
+
+    // The copy refers to names of the callee that are not its own by the
+    // declarations they had there.
+    return !is_captured(in->info[in->caller].fn, info->fn,
+            body->children[NODE_BLOCK_STMTS])
+        && (body->nary != 4
+                || !is_captured(in->info[in->caller].fn, info->fn,
+                    body->children[3]));
+}
+
+static void rename_locals(const inlining *in, ast_node *node)
+{
+    ast_node *var;
+    unsigned int i;
+
+    if (node->decl
+            && (var = (ast_node *) ast_map_lookup(&in->renamed, node->decl))) {
+        node->decl = var;
+
+        if (ast_has_symbol(node))
+            node->data.sval = var->data.sval;
+    }
+
+    for (i = 0; i < node->nary; i++)
+        rename_locals(in, node->children[i]);
+}
+
+// The statements that replace a call, with the local that holds the result
+// of the callee, if any. The parameters and locals of the callee become new
+// locals of the caller.
+static ast_node *expand_call(inlining *in, const ast_node *call,
+        size_t callee, ast_node **result)
+{
+    ast_node *fn = in->info[callee].fn, *body = fn->children[1];
+    ast_node *caller = in->info[in->caller].fn->children[1];
+    ast_node *params = fn->children[0], *args = call->children[0];
+    ast_node *vars = body->children[NODE_BLOCK_VARS];
+    ast_node *stmts = body->children[NODE_BLOCK_STMTS];
+    ast_node *block = NEW_BLOCK(), *decl, *var, *copy;
+    uintptr_t *slot;
+    size_t i;
+
+    *result = NULL;
+    ast_map_clear(&in->renamed);
+
+    if (!block)
+        goto error;
+
+    for (i = 0; i < params->nary + vars->nary; i++) {
+        decl = i < params->nary ? params->children[i]
+            : vars->children[i - params->nary];
+
+        if (!(var = ast_new_local(caller, decl->data.sval,
+                        AST_DATA_TYPE(decl)))
+                || !(slot = ast_map_get(&in->renamed, decl)))
+            goto error;
+
+        *slot = (uintptr_t) var;
+
+        if (i >= params->nary)
+            continue;
+
+        if (!(copy = ast_node_clone(args->children[i]))
+                || !ast_node_append(block, new_assign(var, copy)))
+            goto error;
+    }
+
+    for (i = 0; i < stmts->nary; i++) {
+        if (!(copy = ast_node_clone(stmts->children[i]))
+                || !ast_node_append(block, copy))
+            goto error;
+
+        rename_locals(in, copy);
+    }
+
+    if (body->nary == 4) {
+        if (!(var = ast_new_local(caller, fn->data.sval, AST_DATA_TYPE(fn)))
+                || !(copy = ast_node_clone(body->children[3])))
+            goto error;
+
+        rename_locals(in, copy);
+
+        if (!ast_node_append(block, new_assign(var, copy)))
+            goto error;
+
+        *result = var;
+    }
+
+    if (in->info[callee].depth >= in->info[in->caller].depth)
+        in->info[in->caller].depth = in->info[callee].depth + 1;
+
+    return block;
+
+error:
+    in->error = 1;
+    ast_free_node(block);
+
+    return NULL;
+}
+
+// Use the result of an inlined call instead of the call.
+static int replace_call(ast_node *node, size_t index, ast_node *result)
+{
+    ast_node *call = node->children[index], *value = new_var(result);
+
+    if (!value)
+        return 0;
+
+    value->offset = call->offset;
+    node->children[index] = value;
+    value->parent = node;
+    ast_free_node(call);
+
+    return 1;
+}
+
+typedef enum {
+    CALL_NONE,
+    CALL_FOUND,
+    CALL_BLOCKED,
+} call_search;
+
+// Find the first call of an expression, in the order of evaluation, that
+// can be inlined before the statement that holds it. What is evaluated
+// before the call must not change by moving the call first: it may only read
+// locals of the caller that other functions do not assign, and not call or
+// trap. The call of a statement may also be to a function without a result.
+static call_search find_call(const inlining *in, ast_node *node, size_t index,
+        ast_node **parent, size_t *position)
+{
+    const ast_node *fn = in->info[in->caller].fn;
+    ast_node *expr = node->children[index], *args;
+    call_search found;
+    size_t callee;
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(expr)) {
+    case NODE_CONST:
+        if (AST_DATA_TYPE(expr) != NODE_FLAG_IDENT)
+            return CALL_NONE;
+
+        return is_own(fn, expr->decl)
+            && !ast_map_lookup(&in->shared, expr->decl)
+            ? CALL_NONE : CALL_BLOCKED;
+    case NODE_UNARY_OP:
+    case NODE_CAST:
+        return find_call(in, expr, 0, parent, position);
+    case NODE_BIN_OP:
+        if ((found = find_call(in, expr, 0, parent, position)) != CALL_NONE)
+            return found;
+
+        // The right operand of a logical and or or is not always evaluated.
+        if (expr->data.ival == OP_LAND || expr->data.ival == OP_LOR)
+            return find_call(in, expr, 1, parent, position) == CALL_NONE
+                ? CALL_NONE : CALL_BLOCKED;
+
+        if ((found = find_call(in, expr, 1, parent, position)) != CALL_NONE)
+            return found;
+
+        return may_trap(expr) ? CALL_BLOCKED : CALL_NONE;
+    case NODE_CALL:
+        args = expr->children[0];
+
+        for (i = 0; i < args->nary; i++)
+            if ((found = find_call(in, args, i, parent, position))
+                    != CALL_NONE)
+                return found;
+
+        if (!should_inline(in, expr, &callee)
+                || (AST_NODE_TYPE(node) != NODE_BLOCK
+                    && in->info[callee].fn->children[1]->nary != 4))
+            return CALL_BLOCKED;
+
+        *parent = node;
+        *position = index;
+
+        return CALL_FOUND;
+    default:
+        return CALL_BLOCKED;
+    }
+}
+
+// Inline the call found in a statement before the statement, which is at
+// the index of the block, and move the index past the inlined statements.
+static int inline_call(inlining *in, ast_node *block, size_t *index,
+        ast_node *node, size_t position)
+{
+    ast_node *call = node->children[position], *statements, *result;
+    size_t callee = ast_map_lookup(&in->fns, call->decl) - 1, i;
+
+    if (!(statements = expand_call(in, call, callee, &result)))
+        return 0;
+
+    if (!ast_node_reserve(block, block->nary + statements->nary)
+            || (node != block && !replace_call(node, position, result))) {
+        in->error = 1;
+        ast_free_node(statements);
+        return 0;
+    }
+
+    // A call that is a statement is replaced by the inlined statements.
+    if (node == block) {
+        ast_node_remove(block, *index);
+        ast_free_node(call);
+    }
+
+    for (i = 0; i < statements->nary; i++)
+        ast_node_insert(block, statements->children[i], (*index)++);
+
+    ast_free_leaf(statements);
+
+    return node != block;
+}
+
+// Inline the calls of an expression of a statement in a block, one by one.
+// The expression is a child of the statement, or the statement itself when
+// the node is the block. Returns 0 if the statement was replaced.
+static int inline_expr(inlining *in, ast_node *block, size_t *index,
+        ast_node *node, size_t position)
+{
+    ast_node *parent;
+    size_t found;
+
+    while (!in->error && find_call(in, node,
+                node == block ? *index : position, &parent, &found)
+            == CALL_FOUND)
+        if (!inline_call(in, block, index, parent, found))
+            return 0;
+
+    return 1;
+}
+
+// Inline the calls in a block of statements.
+static void inline_block(inlining *in, ast_node *block)
+{
+    ast_node *stmt, *branch;
+    size_t i, j;
+
+    for (i = 0; i < block->nary && !in->error; i++) {
+        stmt = block->children[i];
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_IF:
+            // The guard of a lowered while-loop holds the loop alone.
+            for (j = 1; j < stmt->nary; j++) {
+                branch = stmt->children[j];
+                inline_block(in, AST_NODE_TYPE(branch) == NODE_DO_WHILE
+                        ? branch->children[1] : branch);
+            }
+
+            inline_expr(in, block, &i, stmt, 0);
+            break;
+        case NODE_DO_WHILE:
+            inline_block(in, stmt->children[1]);
+            break;
+        case NODE_ASSIGN:
+            inline_expr(in, block, &i, stmt, 0);
+            break;
+        case NODE_CALL:
+            // The statements that replace the call are not inlined into.
+            if (!inline_expr(in, block, &i, block, i))
+                i--;
+
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Inline the calls of the result of a function after its statements.
+static void inline_result(inlining *in, ast_node *body)
+{
+    ast_node *stmts = body->children[NODE_BLOCK_STMTS];
+    size_t end = stmts->nary;
+
+    if (body->nary == 4)
+        inline_expr(in, stmts, &end, body, 3);
+}
+
+unsigned int pass_inline_functions(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = { [NODE_ASSIGN] = &mark_shared },
+    };
+
+    inlining in = {.error = 0};
+    ast_node *body;
+    size_t i;
+
+    if (!root || !inline_limit || !inline_depth)
+        return 0;
+
+    in.error = ast_walk(root, &visitor, &in.shared);
+
+    for (i = 0; !in.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD)
+            collect_fn(&in, root->children[i]);
+
+    if (!in.error && in.count
+            && (!(in.stack = malloc(in.count * sizeof(size_t)))
+                || !(in.order = malloc(in.count * sizeof(size_t)))))
+        in.error = 1;
+
+    for (i = 0; !in.error && i < in.count; i++)
+        if (!in.info[i].index)
+            connect_fn(&in, i);
+
+    // Callees come before their callers in the order.
+    for (i = 0; !in.error && i < in.done; i++) {
+        in.caller = in.order[i];
+        body = in.info[in.caller].fn->children[1];
+
+        inline_block(&in, body->children[NODE_BLOCK_STMTS]);
+
+        if (!in.error)
+            inline_result(&in, body);
+    }
+
+    ast_map_free(&in.fns);
+    ast_map_free(&in.shared);
+    ast_map_free(&in.renamed);
+    free(in.info);
+    free(in.stack);
+    free(in.order);
+
+    return in.error;
+}
+
+// Local value numbering gives expressions of a run of statements the same
+// number when they surely have the same value: constants by their value,
+// variables by the value last assigned to them, and operations by their
+// operator and the numbers of their operands. An operation with the number
+// of one evaluated before it reuses that value, through a temporary that is
+// assigned before the statement of the first.
+#define VALUE_TABLE_SIZE 256
+
+// Slots of the table with a number of an earlier run are empty.
+typedef struct {
+    uint32_t kind;
+    uint32_t type;
+    uint64_t a;
+    uint64_t b;
+    size_t value;
+} value_key;
+
+// The first evaluation of a value, which can be moved before its statement,
+// and the temporary it is moved to once the value is reused.
+typedef struct {
+    ast_node *node;
+    ast_node *temp;
+    size_t stmt;
+    size_t seq;
+} value_source;
+
+// The number of an expression node, with the number of nodes of the
+// expression and whether it may be moved before its statement. The numbers
+// of a statement are kept in the order in which the nodes are visited.
+typedef struct {
+    size_t value;
+    size_t size;
+    int movable;
+} value_number;
+
+// The assignment of a temporary to insert before a statement of the block.
+typedef struct {
+    ast_node *assign;
+    size_t stmt;
+    size_t seq;
+} value_temp;
+
+typedef struct {
+    ast_map shared;
+    ast_map vars;
+    ast_map epochs;
+    value_number *numbers;
+    size_t numbers_count;
+    size_t numbers_size;
+    size_t cursor;
+    value_key *table;
+    size_t table_size;
+    size_t table_items;
+    value_source *sources;
+    size_t values;
+    size_t base;
+    size_t sources_size;
+    value_temp *temps;
+    size_t temps_count;
+    size_t temps_size;
+    ast_node *fn;
+    size_t epoch;
+    size_t stmt;
+    size_t seq;
+    int called;
+    unsigned int error;
+} numbering;
+
+// Numbers are not reused by later runs, which start after the base. The
+// sources are those of the numbers of the run.
+static size_t new_value(numbering *n)
+{
+    if (n->values + 1 - n->base >= n->sources_size) {
+        size_t size = n->sources_size ? 2 * n->sources_size : 64;
+        value_source *sources = realloc(n->sources,
+                size * sizeof(value_source));
+
+        if (!sources) {
+            n->error = 1;
+            return 0;
+        }
+
+        n->sources = sources;
+        n->sources_size = size;
+    }
+
+    n->sources[++n->values - n->base] = (value_source){.node = NULL};
+
+    return n->values;
+}
+
+static size_t value_index(const numbering *n, const value_key *key)
+{
+    uint64_t hash = (key->kind | (uint64_t) key->type << 32)
+        * 0x9e3779b97f4a7c15ull;
+    size_t i;
+
+    hash = (hash ^ key->a) * 0x9e3779b97f4a7c15ull;
+    hash = (hash ^ key->b) * 0x9e3779b97f4a7c15ull;
+    i = (hash >> 32) & (n->table_size - 1);
+
+    while (n->table[i].value > n->base && (n->table[i].kind != key->kind
+                || n->table[i].type != key->type || n->table[i].a != key->a
+                || n->table[i].b != key->b))
+        i = (i + 1) & (n->table_size - 1);
+
+    return i;
+}
+
+static int grow_values(numbering *n)
+{
+    size_t size = n->table_size ? 2 * n->table_size : VALUE_TABLE_SIZE;
+    value_key *old = n->table, *table = calloc(size, sizeof(value_key));
+    size_t old_size = n->table_size, i;
+
+    if (!table)
+        return 0;
+
+    n->table = table;
+    n->table_size = size;
+
+    for (i = 0; i < old_size; i++)
+        if (old[i].value > n->base)
+            n->table[value_index(n, old + i)] = old[i];
+
+    free(old);
+
+    return 1;
+}
+
+// The number of a value, which is given a new number when it is not known.
+static size_t find_value(numbering *n, value_key key)
+{
+    size_t i;
+
+    // Keep the table at most half full.
+    if (2 * (n->table_items + 1) > n->table_size && !grow_values(n)) {
+        n->error = 1;
+        return 0;
+    }
+
+    i = value_index(n, &key);
+
+    if (n->table[i].value <= n->base) {
+        key.value = new_value(n);
+        n->table[i] = key;
+        n->table_items++;
+    }
+
+    return n->table[i].value;
+}
+
+// Forget all values, at the start of a run of statements.
+static void forget_values(numbering *n)
+{
+    n->table_items = 0;
+    n->base = n->values;
+}
+
+// Whether a call may assign a variable: all but the locals of the function
+// that no other function assigns.
+static int may_clobber(const numbering *n, const ast_node *decl)
+{
+    return !is_own(n->fn, decl) || ast_map_lookup(&n->shared, decl);
+}
+
+// Each call starts a new epoch. A variable that calls may assign keeps its
+// number only in the epoch in which it got it.
+static size_t set_var(numbering *n, const ast_node *decl, size_t value)
+{
+    uintptr_t *slot;
+
+    if (may_clobber(n, decl)) {
+        if (!(slot = ast_map_get(&n->epochs, decl))) {
+            n->error = 1;
+            return 0;
+        }
+
+        *slot = n->epoch;
+    }
+
+    if (!(slot = ast_map_get(&n->vars, decl))) {
+        n->error = 1;
+        return 0;
+    }
+
+    return *slot = value;
+}
+
+static size_t var_value(numbering *n, const ast_node *decl)
+{
+    size_t value = ast_map_lookup(&n->vars, decl);
+
+    if (value > n->base && (!may_clobber(n, decl)
+                || ast_map_lookup(&n->epochs, decl) == n->epoch))
+        return value;
+
+    return set_var(n, decl, new_value(n));
+}
+
+static int is_commutative(int op)
+{
+    switch (op) {
+    case OP_ADD:
+    case OP_MUL:
+    case OP_EQ:
+    case OP_NE:
+    case OP_AND:
+    case OP_OR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Number an expression and its operands in the order of evaluation. A node
+// may be moved before the statement when it is evaluated before any call and
+// not only under a condition.
+static size_t number_expr(numbering *n, const ast_node *node, int conditional)
+{
+    value_key key = {
+        .kind = AST_NODE_TYPE(node) | (uint32_t) node->data.ival << 4,
+        .type = AST_EXPR_TYPE(node),
+    };
+    union { double d; uint64_t u; } bits;
+    const ast_node *args;
+    size_t entry = n->numbers_count, value = 0, swap;
+    unsigned int i;
+
+    if (entry >= n->numbers_size) {
+        size_t size = n->numbers_size ? 2 * n->numbers_size : 64;
+        value_number *numbers = realloc(n->numbers,
+                size * sizeof(value_number));
+
+        if (!numbers) {
+            n->error = 1;
+            return 0;
+        }
+
+        n->numbers = numbers;
+        n->numbers_size = size;
+    }
+
+    n->numbers_count++;
+
+    switch (AST_NODE_TYPE(node)) {
+    case NODE_CONST:
+        if (AST_DATA_TYPE(node) == NODE_FLAG_IDENT) {
+            value = var_value(n, node->decl);
+            break;
+        }
+
+        bits.d = node->data.dval;
+        key.kind = NODE_CONST;
+        key.type = AST_DATA_TYPE(node);
+        key.a = key.type == NODE_FLAG_FLOAT ? bits.u
+            : (uint32_t) node->data.ival;
+        value = find_value(n, key);
+        break;
+    case NODE_UNARY_OP:
+    case NODE_CAST:
+        key.a = number_expr(n, node->children[0], conditional);
+        value = find_value(n, key);
+        break;
+    case NODE_BIN_OP:
+        key.a = number_expr(n, node->children[0], conditional);
+        key.b = number_expr(n, node->children[1], conditional
+                || node->data.ival == OP_LAND || node->data.ival == OP_LOR);
+
+        if (is_commutative(node->data.ival) && key.a > key.b) {
+            swap = key.a;
+            key.a = key.b;
+            key.b = swap;
+        }
+
+        value = find_value(n, key);
+        break;
+    case NODE_CALL:
+        args = node->children[0];
+
+        for (i = 0; i < args->nary; i++)
+            number_expr(n, args->children[i], conditional);
+
+        n->epoch++;
+        n->called = 1;
+        value = new_value(n);
+        break;
+    default:
+        value = new_value(n);
+        break;
+    }
+
+    n->numbers[entry] = (value_number){
+        .value = value,
+        .size = n->numbers_count - entry,
+        .movable = !n->called && !conditional,
+    };
+
+    return value;
+}
+
+// The local that holds a value evaluated before. The first evaluation is
+// moved to an assignment of the local, to insert before its statement.
+static ast_node *reuse_value(numbering *n, value_source *source)
+{
+    ast_node *node = source->node, *parent = node->parent, *ident;
+    value_temp *temps;
+    size_t i = 0;
+
+    if (source->temp)
+        return new_var(source->temp);
+
+    if (n->temps_count >= n->temps_size) {
+        size_t size = n->temps_size ? 2 * n->temps_size : 16;
+
+        if (!(temps = realloc(n->temps, size * sizeof(value_temp))))
+            return NULL;
+
+        n->temps = temps;
+        n->temps_size = size;
+    }
+
+    if (!(source->temp = ast_new_local(n->fn->children[1], "cse",
+                    AST_EXPR_TYPE(node))) || !(ident = new_var(source->temp)))
+        return NULL;
+
+    while (parent->children[i] != node)
+        i++;
+
+    ident->offset = node->offset;
+    parent->children[i] = ident;
+    ident->parent = parent;
+
+    n->temps[n->temps_count++] = (value_temp){
+        .assign = new_assign(source->temp, node),
+        .stmt = source->stmt,
+        .seq = source->seq,
+    };
+
+    if (!n->temps[n->temps_count - 1].assign)
+        return NULL;
+
+    return new_var(source->temp);
+}
+
+// Replace the operations of a numbered expression whose value was evaluated
+// before by a local that holds it, largest first.
+static void reuse_expr(numbering *n, ast_node *node, size_t index)
+{
+    ast_node *expr = node->children[index], *ident;
+    const value_number *number = n->numbers + n->cursor++;
+    value_source *source;
+    unsigned int i;
+
+    switch (AST_NODE_TYPE(expr)) {
+    case NODE_UNARY_OP:
+    case NODE_CAST:
+    case NODE_BIN_OP:
+        break;
+    case NODE_CALL:
+        for (i = 0; i < expr->children[0]->nary; i++)
+            reuse_expr(n, expr->children[0], i);
+
+        return;
+    default:
+        return;
+    }
+
+    source = n->sources + number->value - n->base;
+
+    if (source->node) {
+        if (!(ident = reuse_value(n, source))) {
+            n->error = 1;
+            return;
+        }
+
+        ident->offset = expr->offset;
+        node->children[index] = ident;
+        ident->parent = node;
+        ast_free_node(expr);
+        n->cursor += number->size - 1;
+
+        return;
+    }
+
+    for (i = 0; i < expr->nary; i++)
+        reuse_expr(n, expr, i);
+
+    if (number->movable)
+        *source = (value_source){
+            .node = expr,
+            .stmt = n->stmt,
+            .seq = n->seq++,
+        };
+}
+
+// Number an expression of the statement at the index of the block and reuse
+// its values. Returns the number of the expression.
+static size_t number_stmt(numbering *n, ast_node *node, size_t index)
+{
+    size_t value;
+
+    n->numbers_count = 0;
+    n->cursor = 0;
+    n->called = 0;
+
+    value = number_expr(n, node->children[index], 0);
+
+    if (!n->error)
+        reuse_expr(n, node, index);
+
+    return value;
+}
+
+static int compare_temps(const void *a, const void *b)
+{
+    const value_temp *x = a, *y = b;
+
+    if (x->stmt != y->stmt)
+        return x->stmt < y->stmt ? -1 : 1;
+
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Insert the assignments of the temporaries from the last, in the order in
+// which their values were first evaluated.
+static void insert_temps(numbering *n, ast_node *block)
+{
+    size_t i;
+
+    qsort(n->temps, n->temps_count, sizeof(value_temp), &compare_temps);
+
+    if (!ast_node_reserve(block, block->nary + n->temps_count)) {
+        n->error = 1;
+        return;
+    }
+
+    for (i = n->temps_count; i--;)
+        ast_node_insert(block, n->temps[i].assign, n->temps[i].stmt);
+}
+
+// Number the runs of statements of a block, which end at the statements
+// that branch. The expression of a function body continues its statements.
+static void number_block(numbering *n, ast_node *block, ast_node *body)
+{
+    ast_node *stmt, *branch;
+    size_t i, j;
+
+    forget_values(n);
+    n->temps_count = 0;
+
+    for (i = 0; i < block->nary && !n->error; i++) {
+        stmt = block->children[i];
+        n->stmt = i;
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_ASSIGN:
+            set_var(n, stmt->decl, number_stmt(n, stmt, 0));
+            break;
+        case NODE_CALL:
+            number_stmt(n, block, i);
+            break;
+        case NODE_IF:
+            number_stmt(n, stmt, 0);
+            forget_values(n);
+            break;
+        default:
+            forget_values(n);
+            break;
+        }
+    }
+
+    if (!n->error && body && body->nary == 4) {
+        n->stmt = block->nary;
+        number_stmt(n, body, 3);
+    }
+
+    if (!n->error && n->temps_count)
+        insert_temps(n, block);
+
+    for (i = 0; i < block->nary && !n->error; i++) {
+        stmt = block->children[i];
+
+        switch (AST_NODE_TYPE(stmt)) {
+        case NODE_IF:
+            // The guard of a lowered while-loop holds the loop alone.
+            for (j = 1; j < stmt->nary; j++) {
+                branch = stmt->children[j];
+                number_block(n, AST_NODE_TYPE(branch) == NODE_DO_WHILE
+                        ? branch->children[1] : branch, NULL);
+            }
+
+            break;
+        case NODE_DO_WHILE:
+            number_block(n, stmt->children[1], NULL);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void number_fn_body(numbering *n, ast_node *fn)
+{
+    ast_node *body = fn->children[1];
+    ast_node *funcs = body->children[NODE_BLOCK_FUNCS];
+    size_t i;
+
+    for (i = 0; i < funcs->nary; i++)
+        if (funcs->children[i]->nary == 2)
+            number_fn_body(n, funcs->children[i]);
+
+    n->fn = fn;
+    number_block(n, body->children[NODE_BLOCK_STMTS], body);
+}
+
+unsigned int pass_eliminate_common_subexprs(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = { [NODE_ASSIGN] = &mark_shared },
+    };
+
+    numbering n = {.error = 0};
+    size_t i;
+
+    if (!root)
+        return 0;
+
+    n.error = ast_walk(root, &visitor, &n.shared);
+
+    for (i = 0; !n.error && i < root->nary; i++)
+        if (AST_NODE_TYPE(root->children[i]) == NODE_FN_HEAD
+                && root->children[i]->nary == 2)
+            number_fn_body(&n, root->children[i]);
+
+    ast_map_free(&n.shared);
+    ast_map_free(&n.vars);
+    ast_map_free(&n.epochs);
+    free(n.numbers);
+    free(n.table);
+    free(n.sources);
+    free(n.temps);
+
+    return n.error;
+}
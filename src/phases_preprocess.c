@@ -4,75 +4,92 @@
 #include "ast.h"
 #include "ast_helpers.h"
 #include "ast_printer.h"
+#include "ast_visitor.h"
 #include "phases.h"
 
-unsigned int pass_split_var_init(ast_node *root)
+static ast_visit_result split_var_def(ast_walker *walker, ast_node *node)
 {
-    ast_node *parent;
-    ast_node *__init = NULL;
-    ast_node *block;
+    ast_node *fn_body = ast_walk_fn_body(walker);
+    ast_node **__init = walker->data;
+    ast_node *block, *assign;
 
-    AST_TRAVERSE_START(root, node)
+    // Split the variable definition into a declaration part and a
+    // initialisation part. The declaration takes the place of the definition.
+    ast_node *var_dec = ast_new_node(NODE_VAR_DEC,
+            (ast_data_type){.sval = node->data.sval});
 
-    if (AST_NODE_TYPE(node) == NODE_VAR_DEF) {
-        parent = node->parent;
+    if (!var_dec)
+        goto error;
 
-        // Split the variable definition into a declaration part and a
-        // initialisation part.
+    ast_flag_set(var_dec, AST_DATA_TYPE(node));
+    var_dec->offset = node->offset;
 
-        ast_node *var_dec = ast_new_node(NODE_VAR_DEC,
-                (ast_data_type){.sval = strdup(node->data.sval)});
+    // Global definitions are initialised by __init.
+    if (!fn_body) {
+        if (!*__init && !(*__init = create_global_init(walker->root)))
+            goto error;
 
-        ast_flag_set(var_dec, AST_DATA_TYPE(node));
+        block = get_func_body_block(*__init, NODE_BLOCK_STMTS);
+    } else
+        block = get_func_body_block(fn_body, NODE_BLOCK_STMTS);
 
-        if (!parent->parent) {
-            if (!__init && !(__init = create_global_init(root)))
-                return 1;
+    if (!block)
+        goto error;
 
-            ast_node_insert(parent, var_dec, 0);
+    // The initialisations go in front of the statements, in the order of the
+    // definitions.
+    if (!(assign = NEW_ASSIGN(node->data.sval)))
+        goto error;
 
-            block = get_func_body_block(__init, NODE_BLOCK_STMTS);
+    assign->offset = node->offset;
 
-            if (!block)
-                return 1;
+    if (!ast_node_append(assign, ast_node_remove(node, 0)) ||
+            !ast_edit_insert(&walker->edits, block, 0, assign))
+        goto error;
 
-            ast_node_insert(block, NEW_ASSIGN(strdup(node->data.sval)), 0);
-            ast_node_append(block->children[0],
-                            ast_node_remove(node, node->children[0]));
-        } else {
-            block = get_func_body_block(parent->parent, NODE_BLOCK_VARS);
+    ast_free_node(node);
 
-            if (!block)
-                return 1;
+    walker->replacement = var_dec;
 
-            ast_node_append(block, var_dec);
+    return AST_VISIT_REPLACE;
 
-            block = get_func_body_block(parent->parent, NODE_BLOCK_STMTS);
+error:
+    walker->error = 1;
 
-            if (!block)
-                return 1;
+    return AST_VISIT_ABORT;
+}
 
-            ast_node_insert(block, NEW_ASSIGN(strdup(node->data.sval)), 0);
-            ast_node_append(block->children[0],
-                            ast_node_remove(node, node->children[0]));
-        }
+static ast_visit_result declare_for_var(ast_walker *walker, ast_node *node)
+{
+    ast_node *var_dec = NEW_VAR_DEC(node->data.sval);
+    ast_node *block = get_func_body_block(ast_walk_fn_body(walker),
+            NODE_BLOCK_VARS);
 
-        ast_node_remove(node->parent, node);
-        ast_free_node(node);
-        node = NULL;
-    } else if (AST_NODE_TYPE(node) == NODE_FOR) {
-        ast_node *var_dec = NEW_VAR_DEC(strdup(node->data.sval));
-        ast_flag_set(var_dec, NODE_FLAG_INT);
+    if (!var_dec || !block) {
+        walker->error = 1;
+        return AST_VISIT_ABORT;
+    }
 
-        block = get_func_body_block(find_func_body(node), NODE_BLOCK_VARS);
+    ast_flag_set(var_dec, NODE_FLAG_INT);
+    var_dec->offset = node->offset;
 
-        if (!block)
-            return 1;
+    // Appending does not move the other variables, so it need not wait for
+    // the end of the walk.
+    ast_node_append(block, var_dec);
 
-        ast_node_append(block, var_dec);
-    }
+    return AST_VISIT_CONTINUE;
+}
 
-    AST_TRAVERSE_END(root, node)
+unsigned int pass_split_var_init(ast_node *root)
+{
+    static const ast_visitor visitor = {
+        .pre = {
+            [NODE_VAR_DEF] = &split_var_def,
+            [NODE_FOR] = &declare_for_var,
+        },
+    };
+
+    ast_node *__init = NULL;
 
-    return 0;
+    return ast_walk(root, &visitor, &__init);
 }
@@ -2,19 +2,38 @@ OBJECTS := \
 	$(b)civcc.o \
 	$(b)civic_parser.o \
 	$(b)civic_lex.o \
+	$(b)arena.o \
 	$(b)ast.o \
+	$(b)ast_binary.o \
+	$(b)ast_edit.o \
+	$(b)ast_frozen.o \
 	$(b)ast_helpers.o \
+	$(b)ast_map.o \
 	$(b)ast_printer.o \
-	$(b)node_stack.o \
+	$(b)ast_visitor.o \
+	$(b)cache.o \
+	$(b)diagnostics.o \
+	$(b)parser.o \
+	$(b)pass_manager.o \
+	$(b)scope.o \
+	$(b)source.o \
+	$(b)stats.o \
+	$(b)symbol.o \
 	$(b)phases_preprocess.o \
 	$(b)phases_analysis.o \
 	$(b)phases_loops.o \
+	$(b)phases_optimize.o \
 
 
-$(OBJECTS): CFLAGS += -I$(b) -I$(s)
+# Everything but the driver, for other programs linking the compiler.
+CIVIC_OBJECTS := $(filter-out $(b)civcc.o,$(OBJECTS))
+
+$(OBJECTS): CFLAGS := $(CFLAGS) -I$(b) -I$(s)
 
 $(b)civic_lex.o: | $(b)civic_parser.o
+$(b)parser.o: | $(b)civic_parser.o
 
+$(b)civcc: LDFLAGS += -lrt -lpthread
 $(b)civcc: $(OBJECTS)
 
 build: $(b)civcc
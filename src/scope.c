@@ -0,0 +1,173 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include "scope.h"
+
+// Symbols are interned, so the pointer itself is a good hash key. The low bits
+// are always zero due to alignment and are mixed in by the multiplication.
+#define SCOPE_HASH(name, size) \
+    ((size_t) (((uintptr_t) (name) * 0x9e3779b97f4a7c15ull) >> 17) & \
+     ((size) - 1))
+
+scope_table *scope_table_new()
+{
+    scope_table *table = malloc(sizeof(scope_table));
+
+    if (!table)
+        return NULL;
+
+    table->slots = calloc(SCOPE_TABLE_SIZE, sizeof(scope_slot));
+    table->slots_items = 0;
+    table->slots_size = SCOPE_TABLE_SIZE;
+
+    table->bindings = malloc(SCOPE_TABLE_SIZE * sizeof(scope_binding));
+    table->items = 0;
+    table->size = SCOPE_TABLE_SIZE;
+
+    table->frames = malloc(SCOPE_FRAMES_SIZE * sizeof(size_t));
+    table->depth = 0;
+    table->frames_size = SCOPE_FRAMES_SIZE;
+
+    if (!table->slots || !table->bindings || !table->frames) {
+        scope_table_free(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+void scope_table_free(scope_table *table)
+{
+    if (!table)
+        return;
+
+    free(table->slots);
+    free(table->bindings);
+    free(table->frames);
+    free(table);
+}
+
+void scope_push(scope_table *table)
+{
+    if (table->depth >= table->frames_size) {
+        table->frames_size *= 2;
+        table->frames = realloc(table->frames, table->frames_size *
+                sizeof(size_t));
+
+        assert(table->frames);
+    }
+
+    table->frames[table->depth++] = table->items;
+}
+
+void scope_pop(scope_table *table)
+{
+    assert(table->depth > 0);
+
+    size_t start = table->frames[--table->depth];
+
+    // Undo the bindings of the frame in reverse order, such that every name
+    // points to the binding it shadowed again.
+    while (table->items > start) {
+        scope_binding *binding = table->bindings + --table->items;
+        table->slots[binding->slot].top = binding->shadowed;
+    }
+}
+
+static void scope_slots_grow(scope_table *table)
+{
+    size_t i, j;
+    size_t size = table->slots_size * 2;
+    scope_slot *slots = calloc(size, sizeof(scope_slot));
+
+    assert(slots);
+
+    for (i = 0; i < table->slots_size; i++) {
+        if (!table->slots[i].name)
+            continue;
+
+        for (j = SCOPE_HASH(table->slots[i].name, size); slots[j].name;
+                j = (j + 1) & (size - 1));
+
+        slots[j] = table->slots[i];
+
+        // Bindings refer to their slot by index, which has moved.
+        if (slots[j].top >= 0) {
+            long b;
+
+            for (b = slots[j].top; b >= 0; b = table->bindings[b].shadowed)
+                table->bindings[b].slot = j;
+        }
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slots_size = size;
+}
+
+static size_t scope_slot_find(scope_table *table, symbol name)
+{
+    size_t i;
+
+    for (i = SCOPE_HASH(name, table->slots_size); table->slots[i].name;
+            i = (i + 1) & (table->slots_size - 1))
+        if (table->slots[i].name == name)
+            return i;
+
+    return i;
+}
+
+ast_index scope_lookup(scope_table *table, symbol name)
+{
+    size_t i = scope_slot_find(table, name);
+
+    if (!table->slots[i].name || table->slots[i].top < 0)
+        return AST_INDEX_NONE;
+
+    return table->bindings[table->slots[i].top].decl;
+}
+
+void scope_bind(scope_table *table, symbol name, ast_index decl)
+{
+    assert(table->depth > 0);
+
+    size_t i = scope_slot_find(table, name);
+
+    if (!table->slots[i].name) {
+        if ((table->slots_items + 1) * 2 > table->slots_size) {
+            scope_slots_grow(table);
+            i = scope_slot_find(table, name);
+        }
+
+        table->slots[i] = (scope_slot){.name = name, .top = -1};
+        table->slots_items++;
+    }
+
+    if (table->items >= table->size) {
+        table->size *= 2;
+        table->bindings = realloc(table->bindings, table->size *
+                sizeof(scope_binding));
+
+        assert(table->bindings);
+    }
+
+    table->bindings[table->items] = (scope_binding){.decl = decl, .slot = i,
+        .shadowed = table->slots[i].top};
+    table->slots[i].top = table->items++;
+}
+
+ast_index scope_declare(scope_table *table, symbol name, ast_index decl)
+{
+    assert(table->depth > 0);
+
+    size_t i = scope_slot_find(table, name);
+    long top = table->slots[i].name ? table->slots[i].top : -1;
+
+    // The innermost binding belongs to the current frame: redeclaration.
+    if (top >= 0 && (size_t) top >= table->frames[table->depth - 1])
+        return table->bindings[top].decl;
+
+    scope_bind(table, name, decl);
+
+    return AST_INDEX_NONE;
+}
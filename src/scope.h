@@ -0,0 +1,48 @@
+#ifndef GUARD_SCOPE__
+
+#include "ast.h"
+#include "ast_frozen.h"
+
+#define SCOPE_TABLE_SIZE 256
+#define SCOPE_FRAMES_SIZE 16
+
+// A binding of a name to the index of its declaration in the frozen tree.
+// When a binding shadows a binding of an enclosing frame, the index of the
+// shadowed binding is kept so it can be restored once the frame is popped.
+typedef struct {
+    ast_index decl;
+    size_t slot;
+    long shadowed;
+} scope_binding;
+
+// Hash slot of a name, pointing to the innermost binding of that name or -1.
+typedef struct {
+    symbol name;
+    long top;
+} scope_slot;
+
+typedef struct {
+    scope_slot *slots;
+    size_t slots_items;
+    size_t slots_size;
+
+    scope_binding *bindings;
+    size_t items;
+    size_t size;
+
+    // Number of bindings at the start of each frame.
+    size_t *frames;
+    unsigned int depth;
+    unsigned int frames_size;
+} scope_table;
+
+scope_table *scope_table_new();
+void scope_table_free(scope_table *table);
+void scope_push(scope_table *table);
+void scope_pop(scope_table *table);
+ast_index scope_lookup(scope_table *table, symbol name);
+ast_index scope_declare(scope_table *table, symbol name, ast_index decl);
+void scope_bind(scope_table *table, symbol name, ast_index decl);
+
+#define GUARD_SCOPE__
+#endif
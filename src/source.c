@@ -0,0 +1,69 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "source.h"
+
+source_file *source_map(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    source_file *source = source_map_fd(fd);
+
+    close(fd);
+
+    return source;
+}
+
+// Map an open file. The descriptor is not needed after this returns. Returns
+// NULL for anything that cannot be mapped, such as pipes, so the caller can
+// fall back to reading it as a stream.
+source_file *source_map_fd(int fd)
+{
+    struct stat st;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    source_file *source = malloc(sizeof(source_file));
+
+    if (!source)
+        return NULL;
+
+    source->size = st.st_size;
+    source->mapped = (source->size + SOURCE_PADDING + page - 1) & ~(page - 1);
+
+    // Reserve zeroed memory for the contents and the padding, then map the
+    // file over it. The tail of the last page of the file reads as zeroes as
+    // well, so the padding is there without copying the file.
+    source->data = mmap(NULL, source->mapped, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (source->data == MAP_FAILED) {
+        free(source);
+        return NULL;
+    }
+
+    if (source->size && mmap(source->data, source->size, PROT_READ |
+                PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(source->data, source->mapped);
+        free(source);
+        return NULL;
+    }
+
+    return source;
+}
+
+void source_unmap(source_file *source)
+{
+    if (!source)
+        return;
+
+    munmap(source->data, source->mapped);
+    free(source);
+}
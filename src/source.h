@@ -0,0 +1,23 @@
+#ifndef GUARD_SOURCE__
+
+#include <stdlib.h>
+
+// Number of NUL bytes following the contents, as required by flex's
+// yy_scan_buffer().
+#define SOURCE_PADDING 2
+
+// A source file mapped into memory. The mapping is private and writable, as
+// the scanner temporarily writes terminators into the buffer while it scans
+// it in place.
+typedef struct {
+    char *data;
+    size_t size;
+    size_t mapped;
+} source_file;
+
+source_file *source_map(const char *filename);
+source_file *source_map_fd(int fd);
+void source_unmap(source_file *source);
+
+#define GUARD_SOURCE__
+#endif
@@ -0,0 +1,145 @@
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "phases.h"
+#include "stats.h"
+
+// The format is set once for the process; the records are kept per thread,
+// for the compilation unit it is working on.
+static stats_format format = STATS_OFF;
+static __thread stats_record *records = NULL;
+static __thread size_t items = 0;
+static __thread size_t size = 0;
+static __thread stats_record *current = NULL;
+
+static double stats_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void stats_enable(stats_format new_format)
+{
+    format = new_format;
+}
+
+int stats_enabled()
+{
+    return format != STATS_OFF;
+}
+
+int stats_json()
+{
+    return format == STATS_JSON;
+}
+
+// Start measuring a step. The returned record is valid until the next call
+// of stats_begin().
+stats_record *stats_begin(const char *phase, const char *name, ast_node *root)
+{
+    if (items >= size) {
+        size = size ? 2 * size : STATS_SIZE;
+        records = realloc(records, size * sizeof(stats_record));
+
+        if (!records)
+            return NULL;
+    }
+
+    stats_record *record = records + items++;
+
+    record->phase = phase;
+    snprintf(record->name, STATS_NAME_SIZE, "%s", name);
+    record->nodes_before = ast_node_count(root);
+    record->removed = 0;
+    record->bytes = ast_allocated();
+    record->cpu = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+    record->wall = stats_clock(CLOCK_MONOTONIC);
+
+    return current = record;
+}
+
+void stats_end(stats_record *record, ast_node *root)
+{
+    if (!record)
+        return;
+
+    record->wall = stats_clock(CLOCK_MONOTONIC) - record->wall;
+    record->cpu = stats_clock(CLOCK_THREAD_CPUTIME_ID) - record->cpu;
+    record->bytes = ast_allocated() - record->bytes;
+    record->nodes_after = ast_node_count(root);
+    current = NULL;
+}
+
+// Count nodes that a pass removed from the tree, for the step that runs it.
+void stats_removed(size_t count)
+{
+    if (current)
+        current->removed += count;
+}
+
+static void stats_print_table(FILE *out)
+{
+    size_t i;
+    double wall = 0, cpu = 0;
+    size_t bytes = 0;
+
+    fprintf(out, "%-10s %-28s %10s %10s %10s %10s %10s %12s\n", "phase",
+            "pass", "wall ms", "cpu ms", "nodes in", "nodes out", "removed",
+            "bytes");
+
+    for (i = 0; i < items; i++) {
+        stats_record *r = records + i;
+
+        fprintf(out, "%-10s %-28s %10.3f %10.3f %10zu %10zu %10zu %12zu\n",
+                r->phase, r->name, r->wall, r->cpu, r->nodes_before,
+                r->nodes_after, r->removed, r->bytes);
+
+        wall += r->wall;
+        cpu += r->cpu;
+        bytes += r->bytes;
+    }
+
+    fprintf(out, "%-10s %-28s %10.3f %10.3f %10s %10s %10s %12zu\n",
+            "total", "", wall, cpu, "", "", "", bytes);
+    fprintf(out, "tree walks by passes: %zu\n", pass_manager_walks());
+}
+
+static void stats_print_json(FILE *out)
+{
+    size_t i;
+
+    fprintf(out, "{\"walks\": %zu, \"steps\": [", pass_manager_walks());
+
+    for (i = 0; i < items; i++) {
+        stats_record *r = records + i;
+
+        fprintf(out, "%s\n  {\"phase\": \"%s\", \"pass\": \"%s\", "
+                "\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"nodes_before\": %zu, "
+                "\"nodes_after\": %zu, \"removed\": %zu, \"bytes\": %zu}",
+                i ? "," : "", r->phase, r->name, r->wall, r->cpu,
+                r->nodes_before, r->nodes_after, r->removed, r->bytes);
+    }
+
+    fprintf(out, "\n]}\n");
+}
+
+void stats_print(FILE *out)
+{
+    switch (format) {
+    case STATS_TABLE: stats_print_table(out); break;
+    case STATS_JSON: stats_print_json(out); break;
+    case STATS_OFF: break;
+    }
+}
+
+void stats_free()
+{
+    free(records);
+    records = NULL;
+    items = size = 0;
+    pass_manager_reset_walks();
+}
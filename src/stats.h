@@ -0,0 +1,39 @@
+#ifndef GUARD_STATS__
+
+#include <stdio.h>
+
+#include "ast.h"
+
+#define STATS_SIZE 32
+#define STATS_NAME_SIZE 64
+
+typedef enum {
+    STATS_OFF,
+    STATS_TABLE,
+    STATS_JSON,
+} stats_format;
+
+// Resources used by one step of the compiler: the parser or a (fused group
+// of) pass(es).
+typedef struct {
+    const char *phase;
+    char name[STATS_NAME_SIZE];
+    double wall;
+    double cpu;
+    size_t nodes_before;
+    size_t nodes_after;
+    size_t bytes;
+    size_t removed;
+} stats_record;
+
+void stats_enable(stats_format format);
+int stats_enabled();
+int stats_json();
+stats_record *stats_begin(const char *phase, const char *name, ast_node *root);
+void stats_end(stats_record *record, ast_node *root);
+void stats_removed(size_t count);
+void stats_print(FILE *out);
+void stats_free();
+
+#define GUARD_STATS__
+#endif
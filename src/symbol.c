@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "symbol.h"
+
+// 32-bit FNV-1a hash.
+static uint32_t symbol_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+symbol_table *symbol_table_new()
+{
+    symbol_table *table = malloc(sizeof(symbol_table));
+
+    if (!table)
+        return NULL;
+
+    table->entries = calloc(SYMBOL_TABLE_SIZE, sizeof(symbol_entry));
+    table->strings = arena_new();
+
+    if (!table->entries || !table->strings) {
+        symbol_table_free(table);
+        return NULL;
+    }
+
+    table->items = 0;
+    table->size = SYMBOL_TABLE_SIZE;
+    table->lookups = 0;
+
+    return table;
+}
+
+void symbol_table_free(symbol_table *table)
+{
+    if (!table)
+        return;
+
+    free(table->entries);
+    arena_free(table->strings);
+    free(table);
+}
+
+static int symbol_table_grow(symbol_table *table)
+{
+    size_t i, j;
+    size_t size = table->size * 2;
+    symbol_entry *entries = calloc(size, sizeof(symbol_entry));
+
+    if (!entries)
+        return 1;
+
+    for (i = 0; i < table->size; i++) {
+        if (!table->entries[i].str)
+            continue;
+
+        for (j = table->entries[i].hash & (size - 1); entries[j].str;
+                j = (j + 1) & (size - 1));
+
+        entries[j] = table->entries[i];
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->size = size;
+
+    return 0;
+}
+
+symbol symbol_intern(symbol_table *table, const char *str, size_t len)
+{
+    uint32_t hash = symbol_hash(str, len);
+    size_t i;
+
+    table->lookups++;
+
+    // Linear probing; the table is kept at most half full.
+    for (i = hash & (table->size - 1); table->entries[i].str;
+            i = (i + 1) & (table->size - 1)) {
+        symbol_entry *entry = table->entries + i;
+
+        if (entry->hash == hash && entry->len == len
+                && memcmp(entry->str, str, len) == 0)
+            return entry->str;
+    }
+
+    char *copy = arena_alloc(table->strings, len + 1);
+
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = 0;
+
+    table->entries[i] = (symbol_entry){.hash = hash, .len = len, .str = copy};
+
+    if (++table->items * 2 > table->size && symbol_table_grow(table))
+        return NULL;
+
+    return copy;
+}
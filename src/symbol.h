@@ -0,0 +1,34 @@
+#ifndef GUARD_SYMBOL__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define SYMBOL_TABLE_SIZE 1024
+
+// An interned identifier. Every distinct name is stored exactly once in its
+// symbol table, so two symbols of the same table are equal if and only if
+// their pointers are equal.
+typedef const char *symbol;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t len;
+    symbol str;
+} symbol_entry;
+
+typedef struct {
+    symbol_entry *entries;
+    size_t items;
+    size_t size;
+    size_t lookups;
+    arena *strings;
+} symbol_table;
+
+symbol_table *symbol_table_new();
+void symbol_table_free(symbol_table *table);
+symbol symbol_intern(symbol_table *table, const char *str, size_t len);
+
+#define GUARD_SYMBOL__
+#endif
@@ -0,0 +1,32 @@
+# A file compiled again with -c is a hit with the same output and exit
+# code. Changing the file or an option that changes the output misses.
+
+cat > "$OUT/a.cvc" <<'CVC'
+extern void printInt(int x);
+export void f() { for (int i = 0, 3) { printInt(i); } }
+CVC
+
+cat > "$OUT/b.cvc" <<'CVC'
+export int g() { bool b = 1; return true; }
+CVC
+
+cd "$OUT"
+
+run() {
+    "$CIVCC" -c cache -S "$@" > run.out 2> run.err
+    echo "exit $? errors $(grep -c 'error:' run.err)"
+    sed -n 's/.*"cache": {\("hits": [0-9]*, "misses": [0-9]*\).*/\1/p' run.err
+}
+
+run -t a.cvc b.cvc
+mv run.out first.out
+run -t a.cvc b.cvc
+cmp first.out run.out
+run -t -e 1 b.cvc
+run -t -e 1 b.cvc
+run -t -u 0 a.cvc
+run -t -u 0 a.cvc
+echo "export void f() { }" > a.cvc
+run -t a.cvc b.cvc
+
+cat first.out
@@ -0,0 +1,36 @@
+# Several files compiled with -j print their output in the order of the
+# files, the same as one by one, and exit with the highest exit code.
+
+cat > "$OUT/a.cvc" <<'CVC'
+extern void printInt(int x);
+export int main() { int a = 2; printInt(a * 3); return a; }
+CVC
+
+cat > "$OUT/b.cvc" <<'CVC'
+int g = true;
+export void f() { g = 1.5; }
+CVC
+
+cat > "$OUT/c.cvc" <<'CVC'
+export float h(float x) { float y = x * 2.0; return y + 1.0; }
+CVC
+
+cd "$OUT"
+
+"$CIVCC" -t a.cvc b.cvc c.cvc a.cvc > serial.out 2> serial.err
+echo "serial exit $?"
+
+for jobs in 2 4 8; do
+    "$CIVCC" -j $jobs -t a.cvc b.cvc c.cvc a.cvc > jobs.out 2> jobs.err
+    echo "-j $jobs exit $?"
+    cmp serial.out jobs.out && cmp serial.err jobs.err
+done
+
+cat serial.err serial.out
+
+# A count that is missing, negative, out of range or not a number is a usage
+# error.
+for opt in "-j 0" "-j -3" -jx "-j 99999999999" "-C abc" -C-1 "-e 1x" -u; do
+    "$CIVCC" $opt a.cvc > usage.out 2>&1
+    echo "$opt exit $? $(cut -d " " -f 1 usage.out | head -n 1)"
+done
@@ -0,0 +1,46 @@
+# A tree written with -w and loaded again compiles to the same trees as the
+# source from the loops phase on, also when loaded with -m.
+
+cat > "$OUT/a.cvc" <<'CVC'
+extern void printInt(int x);
+extern float readFloat();
+
+int g = 3;
+export float scale = 1.5;
+
+int twice(int x) { return x * 2; }
+
+export int main()
+{
+    int s = 0;
+    float f = readFloat();
+    bool b = f > scale;
+
+    void add(int n)
+    {
+        int t = n + g;
+        void more() { s = s + t; }
+        more();
+    }
+
+    for (int i = 0, 10, 3) { add(twice(i)); }
+    while (b) { f = f - 1.0; b = !(f < 0.0); }
+    do { s = s - 1; } while (s > 100);
+    if (s != 0) { printInt((int) f + -s % 7); } else { g = 1; }
+    return s;
+}
+CVC
+
+cd "$OUT"
+
+"$CIVCC" -w -t a.cvc > source.out
+echo "source exit $?"
+sed -n '/^=== loops tree ===$/,$p' source.out > expected.out
+
+for flags in -t "-m -t"; do
+    "$CIVCC" $flags a.cvc.ast > loaded.out
+    echo "loaded with $flags exit $?"
+    cmp expected.out loaded.out
+done
+
+cat expected.out
@@ -0,0 +1,8 @@
+# Each program is compiled with -t, and each script is run. The output and
+# exit code must match the .out file next to it. Run with UPDATE=1 to
+# rewrite them.
+TESTS := $(wildcard $(s)*.cvc) $(filter-out $(s)run.sh,$(wildcard $(s)*.sh))
+
+.PHONY: check
+check: $(BUILD_DIR)src/civcc $(TESTS) | $(TGT_DIR)
+	test/run.sh $< $(BUILD_DIR)test/ $(filter %.cvc %.sh,$^)
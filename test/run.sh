@@ -0,0 +1,40 @@
+#!/bin/sh
+# usage: run.sh CIVCC OUT_DIR TEST...
+#
+# Runs each test from its own directory and compares its output and exit
+# code with the .out file of the same name. A TEST.cvc is compiled with -t.
+# A TEST.sh is run with sh, with CIVCC set to the compiler and OUT to an
+# empty directory for its files. With UPDATE=1, the .out files are
+# rewritten instead.
+
+civcc=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+out=$(cd "$2" && pwd)/
+failed=0
+shift 2
+
+for test in "$@"; do
+    dir=$(dirname "$test")
+    file=$(basename "$test")
+    name=${file%.*}
+    actual=$out$name.out
+
+    case $file in
+    *.sh)
+        rm -rf "$out$name" && mkdir "$out$name"
+        (cd "$dir" && CIVCC=$civcc OUT=$out$name sh "$file" 2>&1;
+            echo "exit $?") > "$actual"
+        ;;
+    *)
+        (cd "$dir" && "$civcc" -t "$file" 2>&1; echo "exit $?") > "$actual"
+        ;;
+    esac
+
+    if [ -n "$UPDATE" ]; then
+        cp "$actual" "$dir/$name.out"
+    elif ! diff -u "$dir/$name.out" "$actual"; then
+        echo "FAIL: $test"
+        failed=1
+    fi
+done
+
+exit $failed